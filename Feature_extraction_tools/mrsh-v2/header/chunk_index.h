@@ -0,0 +1,39 @@
+/*
+ * File:   chunk_index.h
+ *
+ * Inverted index from the chunk hashes kept with -k to the fingerprints
+ * having them. Only the pairs sharing at least min_shared distinct chunks
+ * are compared; the lines printed for them are the same, and in the same
+ * order, as with the serial loops in fingerprintList.c.
+ */
+#ifndef CHUNK_INDEX_H
+#define	CHUNK_INDEX_H
+
+#include "config.h"
+#include "fingerprintList.h"
+
+
+typedef struct {
+    uint64  hash;
+    uint32  id;
+}CHUNK_POSTING;
+
+typedef struct {
+    // Postings sorted by hash and id; those of the hashes with the top
+    // bucket_bits bits b are postings[bucket_start[b]] to postings[bucket_start[b+1]-1]
+    CHUNK_POSTING   *postings;
+    size_t          amount;
+    size_t          *bucket_start;
+    unsigned int    bucket_bits;
+}CHUNK_INDEX;
+
+
+CHUNK_INDEX *build_chunk_index(FINGERPRINT **fps, uint32 amount);
+void        chunk_index_destroy(CHUNK_INDEX *index);
+
+// Both return -1 without comparing if a fingerprint has no chunk hashes
+int         all_against_all_indexed(FINGERPRINT_LIST *fpl, int min_shared);
+int         list_against_list_indexed(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2, int min_shared);
+
+
+#endif	/* CHUNK_INDEX_H */
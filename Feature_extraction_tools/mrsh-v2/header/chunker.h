@@ -0,0 +1,45 @@
+/*
+ * File:   chunker.h
+ *
+ * Chunk boundary detection for the mrsh-v2 rolling hash. A buffer is scanned
+ * for all block ends at once; the FNV hashes of the blocks are computed
+ * afterwards in a separate batch.
+ */
+#ifndef CHUNKER_H
+#define	CHUNKER_H
+#include <stddef.h>
+#include "../header/config.h"
+
+// Number of block ends returned by one call of find_chunk_ends()
+#define CHUNK_BATCH             256
+
+// roll_hashx() depends on the last ROLLING_WINDOW bytes and its shift-xor part on the last 7
+#define ROLLING_HISTORY         (ROLLING_WINDOW > 7 ? ROLLING_WINDOW : 7)
+#define ROLLING_HISTORY_MAX     (ROLLING_WINDOW_MAX > 7 ? ROLLING_WINDOW_MAX : 7)
+
+
+/*
+ * Everything the chunker needs to continue with the next buffer of the same input
+ */
+typedef struct {
+    // The last ROLLING_HISTORY bytes of the profile fed to the rolling hash,
+    // the newest one at history[ROLLING_HISTORY-1]
+    uchar   history[ROLLING_HISTORY_MAX];
+
+    // Input offset of the next buffer
+    uint64  offset;
+
+    // Bytes of SKIPPED_BYTES jump that still have to be skipped at the start of the next buffer
+    uint64  resume;
+
+    // A jump is only done if it stays within the input
+    uint64  size;
+}ROLLING_STATE;
+
+
+void    init_rolling_state(ROLLING_STATE *rs, uint64 size);
+size_t  find_chunk_ends(ROLLING_STATE *rs, const uchar *buffer, size_t length, size_t *ends, size_t max_ends, size_t *scanned);
+void    hash_chunks(const uchar *buffer, const size_t *ends, size_t amount, uint64 seed, uint64 *hashes);
+
+
+#endif	/* CHUNKER_H */
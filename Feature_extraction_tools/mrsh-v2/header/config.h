@@ -8,6 +8,7 @@
 #ifndef CONFIG_H
 #define	CONFIG_H
 
+// Parameters of the default profile; the other profiles are defined in profiles.c
 #define ROLLING_WINDOW          7
 #define BLOCK_SIZE              160// 256
 #define BLOCK_SIZE_MAX          50000
@@ -23,11 +24,25 @@
 #define MAX_BLOOM_ARR           500
 #define PROBABILITY             0.99951172 //Attention: 1 - ( 1/BLOOMFILTERBITSIZE )
 
+// Space reserved for the largest parameters of all profiles
+#define FILTERSIZE_MAX          256
+#define ROLLING_WINDOW_MAX      32
+#define SKIPPED_BYTES_MAX       1024
+
 #define MIN(a,b) (a < b ? a : b)
 #define MAX(a,b) (a > b ? a : b)
 
 #define SLIDING_WINDOW		64
 
+#define STREAM_BUFFER_SIZE      (1 << 20) //bytes read per window when hashing a file in streaming mode
+#define SEGMENT_SIZE            (4 << 20) //bytes per thread when a single file is hashed with several threads
+#define LOAD_RANGE_SIZE         (4 << 20) //bytes of a text digest list per thread at least when it is loaded with several threads
+#define OUTPUT_BUFFER_SIZE      (1 << 20) //bytes of digests and match lines collected before they are written
+#define SPARSE_FILTER_DENSITY   32 //a last filter with at most one bit in SPARSE_FILTER_DENSITY set is stored as the positions of its bits in binary digest files
+#define SIZE_LINE               200 //maximum length of a line in a list of files
+#define COMPARE_TILE            64 //fingerprints per side of a tile when a list is compared with several threads
+#define FILTER_ALIGNMENT        64 //alignment of the Bloom filters of a fingerprint; filter sizes are multiples of it
+
 typedef unsigned long long  uint64; 
 typedef unsigned char       uchar;
 typedef unsigned int        uint32;
@@ -51,6 +66,13 @@ typedef struct{
     bool extract_features_fw;
     bool extract_features_list;	
     bool extract_features_list_check;
+    bool prefetch;
+    short threads;
+    short saturation;
+    bool ordered_output;
+    short min_shared_chunks;
+    short top_k;
+    bool binary_digests;
 } MODES;
 
 
@@ -0,0 +1,70 @@
+/*
+ * File:   digest_file.h
+ *
+ * Binary digest files (-b): a header, one entry per fingerprint, the file
+ * names, the block counts of the filters, the kept chunk hashes, the bit
+ * positions of the sparse last filters and the dense filters, each section
+ * aligned. Lists in this format are mapped
+ * and used in place by -L and -l; the fingerprints point into the mapping.
+ * Integers are stored in the byte order of the machine that wrote the file.
+ */
+#ifndef DIGEST_FILE_H
+#define	DIGEST_FILE_H
+
+#include <stdio.h>
+#include "config.h"
+#include "fingerprintList.h"
+
+#define DIGEST_MAGIC            "MRSHv2BD"
+#define DIGEST_VERSION          2
+#define DIGEST_NO_CHUNKS        0xFFFFFFFF //chunk_count of a fingerprint without kept chunk hashes
+#define DIGEST_DENSE            0xFFFFFFFF //positions of a fingerprint whose last filter is dense
+
+
+typedef struct {
+    char    magic[8];
+    uint32  version;
+    uint32  header_size;
+
+    // Digests are only comparable within the profile that built them
+    char    profile_name[16];
+    uint32  filter_size;
+    uint32  max_blocks;
+
+    uint64  amount;             // fingerprints
+    uint64  filters;
+    uint64  dense_filters;      // filters minus the sparse last ones
+    uint64  chunk_hashes;
+    uint64  positions;
+    uint64  names_size;
+
+    // Start of each section from the start of the file, and its end
+    uint64  entries_offset;
+    uint64  names_offset;
+    uint64  blocks_offset;      // one short per filter
+    uint64  chunks_offset;      // one uint64 per chunk hash
+    uint64  positions_offset;   // one short per bit of a sparse last filter
+    uint64  filters_offset;     // filter_size bytes per filter, FILTER_ALIGNMENT aligned
+    uint64  file_size;
+}DIGEST_HEADER;
+
+typedef struct {
+    uint64  filesize;
+    uint64  first_filter;       // of the block counts
+    uint64  first_dense;        // of the dense filters
+    uint64  first_position;
+    uint64  first_chunk;
+    uint64  name_offset;        // from names_offset, NUL-terminated
+    uint32  filters;            // amount_of_BF+1
+    uint32  chunk_count;
+    uint32  positions;          // bits of the sparse last filter, or DIGEST_DENSE
+    uint32  reserved;
+}DIGEST_ENTRY;
+
+
+bool    is_digest_file(FILE *handle);
+void    write_digest_file(FINGERPRINT_LIST *fpl, FILE *out);
+void    read_digest_file(FINGERPRINT_LIST *fpl, FILE *handle, int threads);
+
+
+#endif	/* DIGEST_FILE_H */
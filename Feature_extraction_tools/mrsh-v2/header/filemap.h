@@ -0,0 +1,29 @@
+/* 
+ * File:   filemap.h
+ *
+ * Input layer shared by the hashing functions: files are mapped into memory
+ * so the chunker scans the page cache directly instead of a heap copy.
+ */
+#ifndef FILEMAP_H
+#define	FILEMAP_H
+#include <stdio.h>
+#include "../header/config.h"
+
+
+typedef struct {
+    // First byte of the file content and its length
+    const unsigned char *data;
+    uint64 size;
+
+    // true if data is a mapping of the file, false if it was read into a heap buffer
+    bool mapped;
+}FILE_MAP;
+
+
+int     map_file(FILE_MAP *map, FILE *handle);
+int     load_file(FILE_MAP *map, FILE *handle);
+void    release_file(FILE_MAP *map);
+void    prefetch_file(const char *filename);
+
+
+#endif	/* FILEMAP_H */
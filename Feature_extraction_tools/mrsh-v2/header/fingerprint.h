@@ -15,9 +15,15 @@
 
 
 typedef struct FINGERPRINT {
-	//List of Bloom filters
-    BLOOMFILTER *bf_list;
-    BLOOMFILTER *bf_list_last_element;
+	// Bloom filters as structure of arrays: filter i is the profile->filter_size
+	// bytes at bf_array + i*profile->filter_size (FILTER_ALIGNMENT aligned), its
+	// number of blocks is bf_blocks[i] and its bits set to one are bf_bits_set[i],
+	// bf_tail_bits[i] of them from the cut point of the compare kernel on.
+    unsigned char   *bf_array;
+    short           *bf_blocks;
+    unsigned short  *bf_bits_set;
+    unsigned short  *bf_tail_bits;
+    unsigned int    bf_capacity;
     
     //Pointer to next fingerprint
     struct FINGERPRINT *next;
@@ -28,7 +34,15 @@ typedef struct FINGERPRINT {
 
    // File name and size of the original file
    char          file_name[200];
-   unsigned int  filesize;
+   uint64        filesize;
+
+   // Sorted, distinct hashes of the chunks of the file, only kept with -k
+   uint64        *chunk_hashes;
+   unsigned int  chunk_count, chunk_capacity;
+   bool          chunks_kept;
+
+   // true if the filters and chunk hashes belong to the digest file of a list (see digest_file.h)
+   bool          mapped;
         
 }FINGERPRINT;
 
@@ -40,8 +54,16 @@ FINGERPRINT         *init_fingerprint_for_file(FILE *handle, char *filename);
 int                 fingerprint_destroy(FINGERPRINT *fp);
 
 int                 fingerprint_compare(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2);
-int                 bloom_max_score(BLOOMFILTER *bf, FINGERPRINT *fingerprint);
+int                 fingerprint_compare_bound(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2, int min_score);
+int                 bloom_max_score(FINGERPRINT *fp, unsigned int bf, FINGERPRINT *fingerprint);
 void                add_hash_to_fingerprint(FINGERPRINT *fp, uint64 hash_value);
+void                add_hash_to_bloomfilter(FINGERPRINT *fp, unsigned int bf, uint64 hash_value);
+void                reserve_bloomfilters(FINGERPRINT *fp, unsigned int amount);
+void                add_chunk_hash(FINGERPRINT *fp, uint64 hash_value);
+void                sort_chunk_hashes(FINGERPRINT *fp);
+bool                is_sparse_filter(unsigned int bits_set);
+unsigned int        collect_positions(const unsigned char *filter, unsigned short *positions);
+void                expand_positions(const unsigned short *positions, unsigned int amount, unsigned char *filter);
 double              compute_e_min(int blocks_in_bf1, int blocks_in_bf2);
 
 //unsigned int        read_input_hash_file(FINGERPRINT_LIST *fpl,FILE *handle);
@@ -50,7 +72,7 @@ void                print_fingerprint(FINGERPRINT *fp);
 
 
 //void         init_fingerprint_for_file(FILE *handle, char *filename);
-void	     init_fingerprint_for_file_NO_BF_NO_CONTEXT(FILE *handle, char *filename);
+int	     init_fingerprint_for_file_NO_BF_NO_CONTEXT(FILE *handle, char *filename, sqlite3 *db);
 int	     init_fingerprint_for_file_NO_BF(FILE *handle, char *filename, sqlite3 *db);
 int          init_fingerprint_for_file_checking(FILE *handle, char *filename, sqlite3 *db);
 
@@ -9,6 +9,7 @@
 #define	FINTERPRINTLIST_H
 
 #include "fingerprint.h"
+#include "filemap.h"
 
 
 
@@ -21,6 +22,12 @@ typedef struct {
     
     // size of the list, used while freeing the memory
     unsigned int size;
+
+    // binary digest file the fingerprints point into, the weights of its filters
+    // and the dense copies of the fingerprints whose last filter it stores sparse
+    FILE_MAP        *digest_file;
+    unsigned short  *filter_weights;
+    unsigned char   *expanded_filters;
     
 }FINGERPRINT_LIST;
 
@@ -45,6 +52,7 @@ void 				fingerprint_against_list_comparison(FINGERPRINT_LIST *fpl, FINGERPRINT
 
 void                print_fingerprintList(FINGERPRINT_LIST *fpl);
 
+FINGERPRINT         *parse_digest_line(char *line);
 unsigned int        read_fingerprint_file(FINGERPRINT_LIST *bloom_arr, FILE *handle);
 
 
@@ -14,20 +14,79 @@
 #include "config.h"
 #include "fingerprint.h"
 #include "bloomfilter.h"
+#include "chunker.h"
 #include <sqlite3.h>
 
 
+// Length passed to hash_context_init() for a stream of unknown length
+#define STREAM_LENGTH_UNKNOWN   0
+
+// Bytes kept to redo the end of a stream of unknown length: a jump and the rolling window before it
+#define STREAM_TAIL             (SKIPPED_BYTES_MAX + ROLLING_HISTORY_MAX)
+
+
+/*
+ * State of the chunker between two buffers of the same input: the rolling
+ * hash, the FNV value of the open block, whether the first block was seen
+ * yet and the input offset of the last block end.
+ */
+typedef struct {
+    ROLLING_STATE rs;
+    uint64  hashvalue;
+    bool    first;
+    bool    ended;
+    uint64  last_end;
+}CHUNK_STATE;
+
+/*
+ * Incremental fingerprinting of a stream: hash_context_init(), any number of
+ * hash_context_update() with pieces of any size, hash_context_final().
+ * The blocks are added to the current Bloom filter of the fingerprint as
+ * soon as they are found, nothing of the input is buffered.
+ */
+typedef struct {
+    CHUNK_STATE  st;
+    FINGERPRINT *fingerprint;
+    uint64  length;
+    uchar   tail[STREAM_TAIL];
+}HASH_CONTEXT;
+
+/*
+ * A feature (block) extracted from a file
+ */
+typedef struct {
+    uint64  hash;
+    uint64  offset;
+    uint32  size;
+}FEATURE;
+
+/*
+ * The features of one file in a contiguous array. The array only grows and
+ * is reused for the next file.
+ */
+typedef struct {
+    FEATURE *items;
+    size_t  amount;
+    size_t  capacity;
+}FEATURE_BUFFER;
+
 
 int         hashFileToFingerprint(FINGERPRINT *fingerprint, FILE *handle);
 uint32      roll_hashx(unsigned char c, uchar window[], uint32 rhData[]);
 uint32      djb2x(unsigned char c, uchar window[], unsigned int n);
 int         hashPacketBuffer(FINGERPRINT *bloom,const unsigned char *packet, const size_t length);
 
+void        hash_context_init(HASH_CONTEXT *ctx, FINGERPRINT *fingerprint, uint64 length);
+void        hash_context_update(HASH_CONTEXT *ctx, const unsigned char *data, size_t length);
+int         hash_context_final(HASH_CONTEXT *ctx);
+
 
 
-int 	    hashFile_features_extraction(unsigned int size, char *filename, FILE *handle, sqlite3 *db);
-int  	    hashFile_features_extraction_checking(unsigned int filesize, char *filename, FILE *handle, sqlite3 *db);
-int         hashFile_features_extraction_no_context(unsigned int filesize, char *filename, FILE *handle);
+int         extract_file_features(FILE *handle, FEATURE_BUFFER *features);
+int         store_file_features(char *filename, const FEATURE_BUFFER *features, sqlite3 *db);
+int 	    hashFile_features_extraction(char *filename, FILE *handle, sqlite3 *db);
+int  	    hashFile_features_extraction_checking(char *filename, FILE *handle, sqlite3 *db);
+int         hashFile_features_extraction_no_context(char *filename, FILE *handle, sqlite3 *db);
 
 
 #endif	/* HASHING_H */
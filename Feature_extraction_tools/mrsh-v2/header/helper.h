@@ -12,6 +12,7 @@
 
 
 FILE    *getFileHandle(char *filename);
+int     read_list_entry(FILE *arq, char *linha);
 
 
 #endif	/* HELPER_H */
@@ -0,0 +1,19 @@
+/*
+ * File:   list_extraction.h
+ *
+ * Feature extraction (-z) of a list of files as a pipeline: a reader thread
+ * walks the list, several threads extract the features and the calling
+ * thread is the only one writing to the database.
+ */
+#ifndef LIST_EXTRACTION_H
+#define	LIST_EXTRACTION_H
+
+#include <stdio.h>
+#include <sqlite3.h>
+#include "config.h"
+
+
+int         extract_list_parallel(FILE *list, sqlite3 *db, int threads, int *num_features);
+
+
+#endif	/* LIST_EXTRACTION_H */
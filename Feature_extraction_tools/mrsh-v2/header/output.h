@@ -0,0 +1,46 @@
+/*
+ * File:   output.h
+ *
+ * Buffered output of digests and match lines. The text is formatted by hand
+ * into a large buffer that is handed to write() once it is full, instead of
+ * one printf() call per pair or per filter byte. Threads format into buffers
+ * of their own and pass them to standard_output with output_shared().
+ */
+#ifndef OUTPUT_H
+#define	OUTPUT_H
+
+#include "config.h"
+
+
+typedef struct {
+    char    *text;
+    size_t  length, capacity;
+
+    // Descriptor the text is written to once the buffer is full, or -1 to grow the buffer instead
+    int     fd;
+
+    // Flush at the end of every record, for a terminal
+    bool    interactive;
+}OUTPUT_BUFFER;
+
+
+// Standard output of the program, flushed when the program exits
+extern OUTPUT_BUFFER standard_output;
+
+void    init_output(OUTPUT_BUFFER *out, int fd);
+void    free_output(OUTPUT_BUFFER *out);
+void    flush_output(OUTPUT_BUFFER *out);
+void    flush_standard_output();
+
+void    output_bytes(OUTPUT_BUFFER *out, const char *text, size_t length);
+void    output_string(OUTPUT_BUFFER *out, const char *text);
+void    output_decimal(OUTPUT_BUFFER *out, long long value, int digits);
+void    output_hex(OUTPUT_BUFFER *out, const unsigned char *data, size_t bytes);
+void    output_hex64(OUTPUT_BUFFER *out, uint64 value);
+void    output_match(OUTPUT_BUFFER *out, const char *name1, const char *name2, int score);
+void    end_output_record(OUTPUT_BUFFER *out);
+
+void    output_shared(const char *text, size_t length);
+
+
+#endif	/* OUTPUT_H */
@@ -0,0 +1,37 @@
+/*
+ * File:   parallel_compare.h
+ *
+ * Compares all fingerprints of a list against each other, or of one list
+ * against another, in tiles with several threads. The lines printed are the
+ * same as with the serial loops in fingerprintList.c; with ordered set or a
+ * single thread they are also printed in the same order.
+ */
+#ifndef PARALLEL_COMPARE_H
+#define	PARALLEL_COMPARE_H
+
+#include "config.h"
+#include "fingerprintList.h"
+
+
+/*
+ * Copies of the fingerprints of a list, linked in the same order, with their
+ * filters in one aligned matrix. Also used by the top-K comparisons (-n).
+ */
+typedef struct {
+    FINGERPRINT     *fps;
+    uint32          amount;
+
+    unsigned char   *matrix;
+    short           *blocks;
+    unsigned short  *bits_set, *tail_bits;
+}PACKED_LIST;
+
+
+void        pack_list(FINGERPRINT_LIST *fpl, PACKED_LIST *packed);
+void        free_packed_list(PACKED_LIST *packed);
+
+int         all_against_all_parallel(FINGERPRINT_LIST *fpl, int threads, bool ordered);
+int         list_against_list_parallel(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2, int threads, bool ordered);
+
+
+#endif	/* PARALLEL_COMPARE_H */
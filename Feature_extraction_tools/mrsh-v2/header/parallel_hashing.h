@@ -0,0 +1,18 @@
+/*
+ * File:   parallel_hashing.h
+ *
+ * Fingerprints a single mapped file with several threads. The file is split
+ * into segments whose block ends are found in parallel and fixed up at the
+ * seams, so the result is the same as with hashFileToFingerprint().
+ */
+#ifndef PARALLEL_HASHING_H
+#define	PARALLEL_HASHING_H
+
+#include "config.h"
+#include "fingerprint.h"
+
+
+int         hash_segments_to_fingerprint(FINGERPRINT *fingerprint, const unsigned char *data, uint64 size, int threads);
+
+
+#endif	/* PARALLEL_HASHING_H */
@@ -0,0 +1,19 @@
+/*
+ * File:   parallel_loading.h
+ *
+ * Reads a text digest list with several threads. The mapped list is split
+ * at line boundaries into one range per thread, the ranges are parsed
+ * concurrently and their fingerprints are appended in the order of the
+ * file, so the list is the same as with read_fingerprint_file().
+ */
+#ifndef PARALLEL_LOADING_H
+#define	PARALLEL_LOADING_H
+
+#include "config.h"
+#include "fingerprintList.h"
+
+
+int         read_fingerprint_file_parallel(FINGERPRINT_LIST *fpl, FILE *handle, int threads);
+
+
+#endif	/* PARALLEL_LOADING_H */
@@ -0,0 +1,49 @@
+/*
+ * File:   profile.h
+ *
+ * Named sets of mrsh-v2 parameters. Every profile comes with its own copy of
+ * the chunker, Bloom filter and compare kernels, compiled with its parameters
+ * as constants; the rest of the program reads the parameters from the
+ * profile selected with -P.
+ */
+#ifndef PROFILE_H
+#define	PROFILE_H
+
+#include "config.h"
+#include "chunker.h"
+#include "fingerprint.h"
+
+
+typedef struct {
+    const char *name;
+    const char *description;
+
+    // Parameters the kernels were compiled with
+    uint32  rolling_history;
+    uint32  block_size;
+    uint32  skipped_bytes;
+    uint32  filter_size;
+    uint32  max_blocks;
+
+    // Kernels
+    size_t          (*find_chunk_ends)(ROLLING_STATE *rs, const uchar *buffer, size_t length, size_t *ends, size_t max_ends, size_t *scanned);
+    void            (*add_hash_to_bloomfilter)(FINGERPRINT *fp, unsigned int bf, uint64 hash_value);
+    unsigned short  (*count_bits)(const unsigned char *filter);
+    unsigned short  (*common_bits)(const unsigned char *bit_array_one, const unsigned char *bit_array_two);
+    unsigned short  (*filter_weights)(const unsigned char *filter, unsigned short *tail_bits);
+    unsigned short  (*common_bits_cut)(const unsigned char *query, const unsigned char *target, unsigned short query_bits, unsigned short query_tail_bits, int cutoff);
+    double          (*compute_e_min)(int blocks_in_bf1, int blocks_in_bf2);
+    int             (*bloom_max_score)(FINGERPRINT *fp, unsigned int bf, FINGERPRINT *fingerprint, int min_score);
+}PARAMETER_PROFILE;
+
+
+// The profile in use, the default one unless another one is selected;
+// init_profile() prepares it once the selection is final
+extern const PARAMETER_PROFILE *profile;
+
+void                     init_profile();
+const PARAMETER_PROFILE *find_profile(const char *name);
+void                     print_profiles(FILE *out);
+
+
+#endif	/* PROFILE_H */
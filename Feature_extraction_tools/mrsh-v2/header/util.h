@@ -12,10 +12,14 @@
 
 
 
-unsigned int	find_file_size(FILE *fh);
+#define FNV64_INIT	0xcbf29ce484222325ULL
+#define FNV64_PRIME	0x00000100000001b3ULL
+
+uint64		find_file_size(FILE *fh);
 //void        	fnv64Bit_old(char *hashstring, uint64 *hashv);
 //void 		fnv64Bit(char hashstring[], uint64 *hashv, int start, int end);
-uint64	 	fnv64Bit( unsigned char pBuffer[], int start, int end);
+uint64	 	fnv64Bit(const unsigned char pBuffer[], uint64 start, uint64 end);
+uint64		fnv64Bit_update(uint64 hashvalue, const unsigned char *pBuffer, size_t length);
 
 
 #endif	/* UTIL_H */
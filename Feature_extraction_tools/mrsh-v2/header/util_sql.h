@@ -16,6 +16,7 @@
 */
 
 #include <sqlite3.h> 
+#include <stdint.h>
 
 #define DATA_BASE "common_features.db"
 #define MRSH
@@ -58,6 +59,9 @@ void finalize_prepared_stmt(sqlite3_stmt *stmt);
 
 void inserting_new_feature_prepared_stmt(int id_obj, char* hash, int size_fet, char* offset, sqlite3 *db, sqlite3_stmt *stmt);
 
+/* binds a feature kept as native integers; hash and offset are stored as hex text of their low 32 bits */
+void inserting_feature_record_prepared_stmt(int id_obj, uint64_t hash, uint32_t size_fet, uint64_t offset, sqlite3_stmt *stmt);
+
 void remove_existing_features(sqlite3 *db, int id_obj);
 
 sqlite3_stmt* prepared_statement_select_num_features(sqlite3 *db);
@@ -0,0 +1,231 @@
+/*
+    File: chunk_index.c
+    Purpose: Candidate pairs from the chunk hashes of the fingerprints
+
+    Two files sharing no chunk can only score through false positives of
+    their Bloom filters. With -k the hashes of the chunks are kept in the
+    fingerprints; an inverted index maps each hash to the fingerprints of
+    the second list having it. For every fingerprint of the first list the
+    postings of its hashes are counted per fingerprint, and only those
+    sharing at least min_shared hashes are compared. The work is then
+    proportional to the shared chunks instead of to the pairs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../header/chunk_index.h"
+#include "../header/output.h"
+
+// Average postings per bucket of the index
+#define POSTINGS_PER_BUCKET     4
+
+
+static int compare_postings(const void *a, const void *b)
+{
+    const CHUNK_POSTING *x = (const CHUNK_POSTING *)a, *y = (const CHUNK_POSTING *)b;
+
+    if(x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    uint32 x = *(const uint32 *)a, y = *(const uint32 *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32 bucket_of(CHUNK_INDEX *index, uint64 hash)
+{
+    return (uint32)(hash >> (64 - index->bucket_bits));
+}
+
+/*
+ * Builds the index of the chunk hashes of fps; the id of a posting is the
+ * position of its fingerprint in fps
+ */
+CHUNK_INDEX *build_chunk_index(FINGERPRINT **fps, uint32 amount)
+{
+    CHUNK_INDEX *index;
+    size_t *fill, buckets, b;
+    uint32 i, j;
+
+    if(!(index = (CHUNK_INDEX *)malloc(sizeof(CHUNK_INDEX)))) {
+        fprintf(stderr,"[*] Error in initializing chunk index \n");
+        exit(-1);
+    }
+
+    index->amount = 0;
+    for(i=0; i<amount; i++)
+        index->amount += fps[i]->chunk_count;
+
+    index->bucket_bits = 1;
+    while(index->bucket_bits < 24 && ((size_t)1 << index->bucket_bits)*POSTINGS_PER_BUCKET < index->amount)
+        index->bucket_bits++;
+    buckets = (size_t)1 << index->bucket_bits;
+
+    index->postings = (CHUNK_POSTING *)malloc((index->amount+1)*sizeof(CHUNK_POSTING));
+    index->bucket_start = (size_t *)calloc(buckets+1, sizeof(size_t));
+    fill = (size_t *)malloc(buckets*sizeof(size_t));
+    if(index->postings == NULL || index->bucket_start == NULL || fill == NULL) {
+        fprintf(stderr,"[*] Error in initializing chunk index \n");
+        exit(-1);
+    }
+
+    //Counting sort by bucket, then sort each bucket by hash and id
+    for(i=0; i<amount; i++)
+        for(j=0; j<fps[i]->chunk_count; j++)
+            index->bucket_start[bucket_of(index, fps[i]->chunk_hashes[j])+1]++;
+    for(b=0; b<buckets; b++) {
+        index->bucket_start[b+1] += index->bucket_start[b];
+        fill[b] = index->bucket_start[b];
+    }
+    for(i=0; i<amount; i++)
+        for(j=0; j<fps[i]->chunk_count; j++) {
+            CHUNK_POSTING *posting = &index->postings[fill[bucket_of(index, fps[i]->chunk_hashes[j])]++];
+            posting->hash = fps[i]->chunk_hashes[j];
+            posting->id = i;
+        }
+    for(b=0; b<buckets; b++)
+        if(index->bucket_start[b+1] - index->bucket_start[b] > 1)
+            qsort(&index->postings[index->bucket_start[b]], index->bucket_start[b+1] - index->bucket_start[b],
+                    sizeof(CHUNK_POSTING), compare_postings);
+
+    free(fill);
+    return index;
+}
+
+void chunk_index_destroy(CHUNK_INDEX *index)
+{
+    free(index->postings);
+    free(index->bucket_start);
+    free(index);
+}
+
+/*
+ * Stores the ids from first_id on sharing at least min_shared hashes with fp
+ * in candidates, in ascending order, and returns their number. counts holds
+ * a zero for each fingerprint of the index and is left that way.
+ */
+static uint32 find_candidates(CHUNK_INDEX *index, FINGERPRINT *fp, uint32 first_id, int min_shared,
+        uint32 *counts, uint32 *candidates)
+{
+    uint32 i, touched = 0, found = 0, id;
+    size_t p, end;
+
+    for(i=0; i<fp->chunk_count; i++) {
+        uint64 hash = fp->chunk_hashes[i];
+        uint32 b = bucket_of(index, hash);
+
+        end = index->bucket_start[b+1];
+        for(p=index->bucket_start[b]; p<end && index->postings[p].hash <= hash; p++) {
+            id = index->postings[p].id;
+            if(index->postings[p].hash == hash && id >= first_id && counts[id]++ == 0)
+                candidates[touched++] = id;
+        }
+    }
+
+    for(i=0; i<touched; i++) {
+        id = candidates[i];
+        if(counts[id] >= (uint32)min_shared)
+            candidates[found++] = id;
+        counts[id] = 0;
+    }
+    qsort(candidates, found, sizeof(uint32), compare_ids);
+    return found;
+}
+
+static FINGERPRINT **list_to_array(FINGERPRINT_LIST *fpl, uint32 *amount)
+{
+    FINGERPRINT **fps, *fp;
+    uint32 i = 0;
+
+    for(fp=fpl->list, *amount=0; fp != NULL; fp=fp->next)
+        (*amount)++;
+    if(!(fps = (FINGERPRINT **)malloc((*amount+1)*sizeof(FINGERPRINT *)))) {
+        fprintf(stderr,"[*] Error in initializing chunk index \n");
+        exit(-1);
+    }
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        fps[i++] = fp;
+    return fps;
+}
+
+/*
+ * Sorts the chunk hashes of the fingerprints; false if one has none kept
+ */
+static bool prepare_chunks(FINGERPRINT **fps, uint32 amount)
+{
+    uint32 i;
+
+    for(i=0; i<amount; i++)
+        if(!fps[i]->chunks_kept)
+            return false;
+    for(i=0; i<amount; i++)
+        sort_chunk_hashes(fps[i]);
+    return true;
+}
+
+/*
+ * Compares rows against columns, or rows against itself if columns is NULL
+ */
+static int compare_indexed(FINGERPRINT **rows, uint32 row_amount, FINGERPRINT **columns, uint32 column_amount, int min_shared)
+{
+    bool triangular = (columns == NULL);
+    CHUNK_INDEX *index;
+    uint32 *counts, *candidates, found, i, k;
+    int score;
+
+    if(!prepare_chunks(rows, row_amount) || (!triangular && !prepare_chunks(columns, column_amount)))
+        return -1;
+    if(triangular) {
+        columns = rows;
+        column_amount = row_amount;
+    }
+
+    index = build_chunk_index(columns, column_amount);
+    counts = (uint32 *)calloc(column_amount+1, sizeof(uint32));
+    candidates = (uint32 *)malloc((column_amount+1)*sizeof(uint32));
+    if(counts == NULL || candidates == NULL) {
+        fprintf(stderr,"[*] Error in initializing chunk index \n");
+        exit(-1);
+    }
+
+    for(i=0; i<row_amount; i++) {
+        found = find_candidates(index, rows[i], triangular ? i+1 : 0, min_shared, counts, candidates);
+        for(k=0; k<found; k++) {
+            score = fingerprint_compare_bound(rows[i], columns[candidates[k]], mode->threshold);
+            if(score >= mode->threshold)
+                output_match(&standard_output, rows[i]->file_name, columns[candidates[k]]->file_name, score);
+        }
+    }
+
+    free(counts);
+    free(candidates);
+    chunk_index_destroy(index);
+    return 1;
+}
+
+
+int all_against_all_indexed(FINGERPRINT_LIST *fpl, int min_shared)
+{
+    uint32 amount;
+    FINGERPRINT **fps = list_to_array(fpl, &amount);
+    int result = compare_indexed(fps, amount, NULL, 0, min_shared);
+
+    free(fps);
+    return result;
+}
+
+int list_against_list_indexed(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2, int min_shared)
+{
+    uint32 amount1, amount2;
+    FINGERPRINT **fps1 = list_to_array(fpl1, &amount1);
+    FINGERPRINT **fps2 = list_to_array(fpl2, &amount2);
+    int result = compare_indexed(fps1, amount1, fps2, amount2, min_shared);
+
+    free(fps1);
+    free(fps2);
+    return result;
+}
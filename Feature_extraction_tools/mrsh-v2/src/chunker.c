@@ -0,0 +1,71 @@
+/*
+    File: chunker.c
+    Purpose: Find the block ends of the mrsh-v2 rolling hash for a whole
+             buffer and hash the blocks in a batch.
+*/
+
+#include <string.h>
+#include "../header/chunker.h"
+#include "../header/util.h"
+#include "../header/profile.h"
+
+
+
+void init_rolling_state(ROLLING_STATE *rs, uint64 size)
+{
+    memset(rs, 0, sizeof(ROLLING_STATE));
+    rs->size = size;
+}
+
+/*
+ * Scans buffer for block ends with the same semantics as the roll_hashx() loop:
+ * after each block end the next SKIPPED_BYTES bytes are not fed to the rolling
+ * hash unless the jump would leave the input. Writes the buffer positions of
+ * the last byte of each block to ends and returns their amount.
+ *
+ * At most max_ends ends are returned; *scanned tells how many bytes of the
+ * buffer were consumed, the rest has to be passed in again. The scan itself
+ * is done by the kernel of the profile in use (profile_kernels.c).
+ */
+size_t find_chunk_ends(ROLLING_STATE *rs, const uchar *buffer, size_t length, size_t *ends, size_t max_ends, size_t *scanned)
+{
+    return profile->find_chunk_ends(rs, buffer, length, ends, max_ends, scanned);
+}
+
+/*
+ * FNV-1 hashes of the blocks ending at ends[]: the first block starts at
+ * buffer[0] and continues the hash value seed, every other block starts right
+ * after the end of the previous one. Four blocks are hashed side by side to
+ * hide the latency of the multiplication.
+ */
+void hash_chunks(const uchar *buffer, const size_t *ends, size_t amount, uint64 seed, uint64 *hashes)
+{
+    size_t j, i, l, shortest;
+    size_t start[4], length[4];
+    uint64 h[4];
+
+    for(j=0; j+4 <= amount; j+=4) {
+        shortest = (size_t)-1;
+        for(l=0; l<4; l++) {
+            start[l]  = (j+l == 0) ? 0 : ends[j+l-1]+1;
+            length[l] = ends[j+l]+1 - start[l];
+            h[l]      = (j+l == 0) ? seed : FNV64_INIT;
+            shortest  = MIN(shortest, length[l]);
+        }
+
+        for(i=0; i<shortest; i++) {
+            h[0] = (h[0] ^ buffer[start[0]+i]) * FNV64_PRIME;
+            h[1] = (h[1] ^ buffer[start[1]+i]) * FNV64_PRIME;
+            h[2] = (h[2] ^ buffer[start[2]+i]) * FNV64_PRIME;
+            h[3] = (h[3] ^ buffer[start[3]+i]) * FNV64_PRIME;
+        }
+
+        for(l=0; l<4; l++)
+            hashes[j+l] = fnv64Bit_update(h[l], &buffer[start[l]+shortest], length[l]-shortest);
+    }
+
+    for(; j<amount; j++) {
+        i = (j == 0) ? 0 : ends[j-1]+1;
+        hashes[j] = fnv64Bit_update((j == 0) ? seed : FNV64_INIT, &buffer[i], ends[j]+1-i);
+    }
+}
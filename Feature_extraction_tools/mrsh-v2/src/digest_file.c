@@ -0,0 +1,395 @@
+/*
+    File: digest_file.c
+    Purpose: Writing and mapping binary digest files (see digest_file.h)
+
+    A text digest has to be split, copied and converted from hex byte by
+    byte. A binary digest file is mapped as it is: the filters, their block
+    counts and the chunk hashes of the fingerprints point into the mapping,
+    and only the weights of the filters are counted when it is loaded. The
+    filters of a fingerprint whose last filter is stored as bit positions
+    are copied and expanded, since comparisons only work on dense filters.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../header/digest_file.h"
+#include "../header/filemap.h"
+#include "../header/profile.h"
+
+#define ALIGN_UP(x, a)          (((x) + (a)-1) / (a) * (a))
+
+
+/*
+ * Checks for the magic of a binary digest file and rewinds the handle. Only
+ * regular files are checked: a pipe cannot be rewound, so anything else is
+ * read as a text list.
+ */
+bool is_digest_file(FILE *handle)
+{
+    char magic[sizeof(((DIGEST_HEADER *)0)->magic)];
+    struct stat st;
+    bool found;
+
+    if(fstat(fileno(handle), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    found = (fread(magic, 1, sizeof(magic), handle) == sizeof(magic) &&
+            memcmp(magic, DIGEST_MAGIC, sizeof(magic)) == 0);
+    rewind(handle);
+    return found;
+}
+
+static void write_padding(FILE *out, uint64 *written, uint64 offset)
+{
+    static const unsigned char zeros[FILTER_ALIGNMENT];
+
+    fwrite(zeros, 1, offset - *written, out);
+    *written = offset;
+}
+
+//Whether the last filter of fp is stored as the positions of its bits
+static bool has_sparse_last(FINGERPRINT *fp)
+{
+    return is_sparse_filter(fp->bf_bits_set[fp->amount_of_BF]);
+}
+
+static void write_section(FILE *out, uint64 *written, const void *data, uint64 size)
+{
+    if(size > 0 && fwrite(data, 1, size, out) != size) {
+        fprintf(stderr,"[*] Error in writing digest file \n");
+        exit(-1);
+    }
+    *written += size;
+}
+
+void write_digest_file(FINGERPRINT_LIST *fpl, FILE *out)
+{
+    DIGEST_HEADER header;
+    DIGEST_ENTRY entry;
+    FINGERPRINT *fp;
+    unsigned short scratch[FILTERSIZE_MAX*8];
+    uint64 written = 0, filters = 0, dense = 0, bits = 0, chunks = 0, names = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DIGEST_MAGIC, sizeof(header.magic));
+    header.version = DIGEST_VERSION;
+    header.header_size = sizeof(DIGEST_HEADER);
+    strncpy(header.profile_name, profile->name, sizeof(header.profile_name)-1);
+    header.filter_size = profile->filter_size;
+    header.max_blocks = profile->max_blocks;
+
+    for(fp=fpl->list; fp != NULL; fp=fp->next) {
+        header.amount++;
+        header.filters += fp->amount_of_BF+1;
+        if(has_sparse_last(fp)) {
+            header.dense_filters += fp->amount_of_BF;
+            header.positions += fp->bf_bits_set[fp->amount_of_BF];
+        }
+        else
+            header.dense_filters += fp->amount_of_BF+1;
+        header.names_size += strlen(fp->file_name)+1;
+        if(fp->chunks_kept) {
+            sort_chunk_hashes(fp);
+            header.chunk_hashes += fp->chunk_count;
+        }
+    }
+
+    header.entries_offset = ALIGN_UP(sizeof(DIGEST_HEADER), 8);
+    header.names_offset   = header.entries_offset + header.amount*sizeof(DIGEST_ENTRY);
+    header.blocks_offset  = ALIGN_UP(header.names_offset + header.names_size, 8);
+    header.chunks_offset  = ALIGN_UP(header.blocks_offset + header.filters*sizeof(short), 8);
+    header.positions_offset = ALIGN_UP(header.chunks_offset + header.chunk_hashes*sizeof(uint64), 8);
+    header.filters_offset = ALIGN_UP(header.positions_offset + header.positions*sizeof(short), FILTER_ALIGNMENT);
+    header.file_size      = header.filters_offset + header.dense_filters*profile->filter_size;
+
+    write_section(out, &written, &header, sizeof(header));
+
+    write_padding(out, &written, header.entries_offset);
+    for(fp=fpl->list; fp != NULL; fp=fp->next) {
+        memset(&entry, 0, sizeof(entry));
+        entry.filesize     = fp->filesize;
+        entry.first_filter   = filters;
+        entry.first_dense    = dense;
+        entry.first_position = bits;
+        entry.first_chunk    = chunks;
+        entry.name_offset    = names;
+        entry.filters        = fp->amount_of_BF+1;
+        entry.chunk_count    = fp->chunks_kept ? fp->chunk_count : DIGEST_NO_CHUNKS;
+        entry.positions      = DIGEST_DENSE;
+        if(has_sparse_last(fp))
+            entry.positions  = fp->bf_bits_set[fp->amount_of_BF];
+        write_section(out, &written, &entry, sizeof(entry));
+
+        filters += entry.filters;
+        if(entry.positions == DIGEST_DENSE)
+            dense += entry.filters;
+        else {
+            dense += entry.filters-1;
+            bits += entry.positions;
+        }
+        names += strlen(fp->file_name)+1;
+        if(fp->chunks_kept)
+            chunks += fp->chunk_count;
+    }
+
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        write_section(out, &written, fp->file_name, strlen(fp->file_name)+1);
+
+    write_padding(out, &written, header.blocks_offset);
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        write_section(out, &written, fp->bf_blocks, (fp->amount_of_BF+1)*sizeof(short));
+
+    write_padding(out, &written, header.chunks_offset);
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        if(fp->chunks_kept)
+            write_section(out, &written, fp->chunk_hashes, fp->chunk_count*sizeof(uint64));
+
+    write_padding(out, &written, header.positions_offset);
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        if(has_sparse_last(fp)) {
+            collect_positions(&fp->bf_array[(size_t)fp->amount_of_BF*profile->filter_size], scratch);
+            write_section(out, &written, scratch, fp->bf_bits_set[fp->amount_of_BF]*sizeof(short));
+        }
+
+    write_padding(out, &written, header.filters_offset);
+    for(fp=fpl->list; fp != NULL; fp=fp->next)
+        write_section(out, &written, fp->bf_array,
+                (uint64)(has_sparse_last(fp) ? fp->amount_of_BF : fp->amount_of_BF+1)*profile->filter_size);
+
+    //fwrite() only fills the stdio buffer, errors show up once it is flushed
+    if(fflush(out) != 0 || ferror(out)) {
+        fprintf(stderr,"[*] Error in writing digest file \n");
+        exit(-1);
+    }
+}
+
+
+static void corrupt_digest_file(const char *reason)
+{
+    fprintf(stderr,"[*] Error in reading digest file: %s \n", reason);
+    exit(-1);
+}
+
+//Whether amount items from first on do not fit into total, without overflowing
+static bool out_of_range(uint64 first, uint64 amount, uint64 total)
+{
+    return amount > total || first > total - amount;
+}
+
+typedef struct {
+    const unsigned char *data;
+    const DIGEST_HEADER *header;
+    unsigned short      *filter_weights;
+    unsigned char       *expanded_filters;
+
+    // Entries turned into fingerprints, and whose filters are weighed, by this thread
+    uint64  first_entry, end_entry;
+
+    // First filter in expanded_filters of the sparse entries of this thread
+    uint64  first_expanded;
+
+    // Fingerprints of these entries in file order
+    FINGERPRINT *first, *last;
+}DIGEST_RANGE;
+
+static void *read_digest_range(void *arg)
+{
+    DIGEST_RANGE *range = (DIGEST_RANGE *)arg;
+    const DIGEST_HEADER *header = range->header;
+    const DIGEST_ENTRY *entries = (const DIGEST_ENTRY *)&range->data[header->entries_offset];
+    const char *names = (const char *)&range->data[header->names_offset];
+    const unsigned short *all_positions = (const unsigned short *)&range->data[header->positions_offset];
+    unsigned short *weights = range->filter_weights;
+    unsigned char *expanded = &range->expanded_filters[range->first_expanded*profile->filter_size];
+    FINGERPRINT *fp;
+    uint64 i, f;
+
+    for(i=range->first_entry; i<range->end_entry; i++) {
+        const DIGEST_ENTRY *entry = &entries[i];
+        bool sparse = (entry->positions != DIGEST_DENSE);
+        uint64 dense = sparse ? (uint64)entry->filters-1 : entry->filters;
+        const unsigned short *positions;
+        const unsigned char *filters;
+
+        if(entry->filters == 0 || out_of_range(entry->first_filter, entry->filters, header->filters) ||
+                out_of_range(entry->first_dense, dense, header->dense_filters) ||
+                (sparse && out_of_range(entry->first_position, entry->positions, header->positions)) ||
+                entry->name_offset >= header->names_size ||
+                memchr(&names[entry->name_offset], '\0', MIN(header->names_size - entry->name_offset, 200)) == NULL ||
+                (entry->chunk_count != DIGEST_NO_CHUNKS && out_of_range(entry->first_chunk, entry->chunk_count, header->chunk_hashes)))
+            corrupt_digest_file("entry out of range");
+        positions = &all_positions[entry->first_position];
+        filters = &range->data[header->filters_offset + entry->first_dense*profile->filter_size];
+
+        //a sparse last filter is expanded behind a copy of the dense filters before it
+        if(sparse) {
+            for(f=0; f<entry->positions; f++)
+                if(positions[f] >= profile->filter_size*8 || (f > 0 && positions[f] <= positions[f-1]))
+                    corrupt_digest_file("bit positions out of range");
+            memcpy(expanded, filters, dense*profile->filter_size);
+            expand_positions(positions, entry->positions, &expanded[dense*profile->filter_size]);
+            filters = expanded;
+            expanded += (size_t)entry->filters*profile->filter_size;
+        }
+
+        //the weights of the filters are not stored but counted once
+        for(f=0; f<entry->filters; f++)
+            weights[entry->first_filter + f] = profile->filter_weights(&filters[f*profile->filter_size],
+                    &weights[header->filters + entry->first_filter + f]);
+
+        if(!(fp = (FINGERPRINT *)calloc(1, sizeof(FINGERPRINT))))
+            corrupt_digest_file("out of memory");
+
+        fp->bf_array     = (unsigned char *)filters;
+        fp->bf_blocks    = (short *)&range->data[header->blocks_offset] + entry->first_filter;
+        fp->bf_bits_set  = &weights[entry->first_filter];
+        fp->bf_tail_bits = &weights[header->filters + entry->first_filter];
+        fp->bf_capacity  = entry->filters;
+        fp->amount_of_BF = entry->filters-1;
+
+        strcpy(fp->file_name, &names[entry->name_offset]);
+        fp->filesize = entry->filesize;
+
+        if(entry->chunk_count != DIGEST_NO_CHUNKS) {
+            fp->chunk_hashes   = (uint64 *)&range->data[header->chunks_offset] + entry->first_chunk;
+            fp->chunk_count    = entry->chunk_count;
+            fp->chunk_capacity = entry->chunk_count;
+            fp->chunks_kept    = true;
+        }
+
+        fp->mapped = true;
+        fp->next = NULL;
+        if(range->first == NULL)
+            range->first = fp;
+        else
+            range->last->next = fp;
+        range->last = fp;
+    }
+    return NULL;
+}
+
+/*
+ * Maps a binary digest file and adds its fingerprints to fpl, which keeps
+ * the mapping until it is destroyed. With several threads, each one sets up
+ * a range of fingerprints and counts the weights of their filters.
+ */
+void read_digest_file(FINGERPRINT_LIST *fpl, FILE *handle, int threads)
+{
+    const DIGEST_HEADER *header;
+    const DIGEST_ENTRY *entries;
+    unsigned char *data;
+    DIGEST_RANGE *ranges;
+    pthread_t *workers;
+    bool *started;
+    uint64 expanded = 0, i;
+    int k;
+
+    if(fpl->digest_file != NULL)
+        corrupt_digest_file("the list already holds a digest file");
+    if(!(fpl->digest_file = (FILE_MAP *)malloc(sizeof(FILE_MAP))) || load_file(fpl->digest_file, handle) != 0)
+        corrupt_digest_file("cannot be loaded");
+    fclose(handle);
+
+    //a file read into the heap instead of mapped is copied to aligned filters
+    if(!fpl->digest_file->mapped) {
+        if(posix_memalign((void **)&data, FILTER_ALIGNMENT, fpl->digest_file->size) != 0)
+            corrupt_digest_file("out of memory");
+        memcpy(data, fpl->digest_file->data, fpl->digest_file->size);
+        free((void *)fpl->digest_file->data);
+        fpl->digest_file->data = data;
+    }
+
+    data = (unsigned char *)fpl->digest_file->data;
+    header = (const DIGEST_HEADER *)data;
+
+    if(fpl->digest_file->size < sizeof(DIGEST_HEADER) || memcmp(header->magic, DIGEST_MAGIC, sizeof(header->magic)) != 0)
+        corrupt_digest_file("no digest file");
+    if(header->version != DIGEST_VERSION || header->header_size != sizeof(DIGEST_HEADER))
+        corrupt_digest_file("unsupported version or byte order");
+    if(strncmp(header->profile_name, profile->name, sizeof(header->profile_name)) != 0 ||
+            header->filter_size != profile->filter_size || header->max_blocks != profile->max_blocks) {
+        fprintf(stderr,"[*] Error in reading digest file: written with profile %.16s, select it with -P \n", header->profile_name);
+        exit(-1);
+    }
+    //each section ends before the next one starts; the sizes are divided, not multiplied
+    if(header->file_size > fpl->digest_file->size || header->entries_offset < sizeof(DIGEST_HEADER) ||
+            header->entries_offset > header->names_offset ||
+            header->amount > (header->names_offset - header->entries_offset)/sizeof(DIGEST_ENTRY) ||
+            out_of_range(header->names_offset, header->names_size, header->blocks_offset) ||
+            header->blocks_offset > header->chunks_offset ||
+            header->filters > (header->chunks_offset - header->blocks_offset)/sizeof(short) ||
+            header->chunks_offset > header->positions_offset ||
+            header->chunk_hashes > (header->positions_offset - header->chunks_offset)/sizeof(uint64) ||
+            header->positions_offset > header->filters_offset ||
+            header->positions > (header->filters_offset - header->positions_offset)/sizeof(short) ||
+            header->filters_offset > header->file_size ||
+            header->dense_filters > (header->file_size - header->filters_offset)/profile->filter_size ||
+            header->entries_offset % 8 != 0 || header->blocks_offset % 8 != 0 || header->chunks_offset % 8 != 0 ||
+            header->positions_offset % 8 != 0 || header->filters_offset % FILTER_ALIGNMENT != 0)
+        corrupt_digest_file("sections out of range");
+
+    if(!(fpl->filter_weights = (unsigned short *)malloc((2*header->filters+1)*sizeof(unsigned short))))
+        corrupt_digest_file("out of memory");
+
+    //small files are not worth a thread per range
+    threads = (int)MIN((uint64)threads, header->dense_filters*profile->filter_size/LOAD_RANGE_SIZE + 1);
+
+    ranges  = (DIGEST_RANGE *)calloc(threads, sizeof(DIGEST_RANGE));
+    workers = (pthread_t *)malloc(threads*sizeof(pthread_t));
+    started = (bool *)calloc(threads, sizeof(bool));
+    if(ranges == NULL || workers == NULL || started == NULL)
+        corrupt_digest_file("out of memory");
+
+    for(k=0; k<threads; k++) {
+        ranges[k].data = data;
+        ranges[k].header = header;
+        ranges[k].filter_weights = fpl->filter_weights;
+        ranges[k].first_entry  = header->amount*k/threads;
+        ranges[k].end_entry    = header->amount*(k+1)/threads;
+    }
+
+    //room for the dense filters of the fingerprints with a sparse last filter
+    entries = (const DIGEST_ENTRY *)&data[header->entries_offset];
+    for(k=0; k<threads; k++) {
+        ranges[k].first_expanded = expanded;
+        for(i=ranges[k].first_entry; i<ranges[k].end_entry; i++)
+            if(entries[i].positions != DIGEST_DENSE && entries[i].filters <= header->filters)
+                expanded += entries[i].filters;
+    }
+    if(expanded > header->filters)
+        corrupt_digest_file("entry out of range");
+    if(expanded > 0 && posix_memalign((void **)&fpl->expanded_filters, FILTER_ALIGNMENT, expanded*profile->filter_size) != 0)
+        corrupt_digest_file("out of memory");
+    for(k=0; k<threads; k++)
+        ranges[k].expanded_filters = fpl->expanded_filters;
+
+    for(k=1; k<threads; k++)
+        started[k] = (pthread_create(&workers[k], NULL, read_digest_range, &ranges[k]) == 0);
+
+    read_digest_range(&ranges[0]);
+
+    for(k=1; k<threads; k++) {
+        if(started[k])
+            pthread_join(workers[k], NULL);
+        else
+            read_digest_range(&ranges[k]);
+    }
+
+    for(k=0; k<threads; k++) {
+        if(ranges[k].first == NULL)
+            continue;
+        if(fpl->list == NULL)
+            fpl->list = ranges[k].first;
+        else
+            fpl->last_element->next = ranges[k].first;
+        fpl->last_element = ranges[k].last;
+    }
+    fpl->size += header->amount;
+
+    free(ranges);
+    free(workers);
+    free(started);
+}
@@ -0,0 +1,98 @@
+/*
+    File: filemap.c
+    Purpose: Memory-mapped input for the mrsh-v2 hashing functions
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../header/filemap.h"
+
+
+/*
+ * Maps the whole file read-only and tells the kernel we scan it once from
+ * front to back. Returns -1 if the file cannot be mapped (empty file, pipe,
+ * special file...), the caller should then read it instead.
+ */
+int map_file(FILE_MAP *map, FILE *handle){
+	struct stat st;
+	void *addr;
+	int fd = fileno(handle);
+
+	map->data = NULL;
+	map->size = 0;
+	map->mapped = false;
+
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return -1;
+
+	if((addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		return -1;
+
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	map->data = (const unsigned char *)addr;
+	map->size = st.st_size;
+	map->mapped = true;
+	return 0;
+}
+
+
+/*
+ * Same as map_file() but falls back to reading the file into a heap buffer
+ * when it cannot be mapped. Returns -1 if nothing could be read.
+ */
+int load_file(FILE_MAP *map, FILE *handle){
+	unsigned char *buffer;
+	off_t size;
+
+	if(map_file(map, handle) == 0)
+		return 0;
+
+	if(fseeko(handle, 0, SEEK_END) != 0 || (size = ftello(handle)) <= 0)
+		return -1;
+
+	if((buffer = (unsigned char *)malloc(size)) == NULL)
+		return -1;
+
+	fseeko(handle, 0, SEEK_SET);
+	if((map->size = fread(buffer, sizeof(unsigned char), size, handle)) == 0) {
+		free(buffer);
+		return -1;
+	}
+
+	map->data = buffer;
+	return 0;
+}
+
+
+void release_file(FILE_MAP *map){
+	if(map->data == NULL)
+		return;
+
+	if(map->mapped)
+		munmap((void *)map->data, map->size);
+	else
+		free((void *)map->data);
+
+	map->data = NULL;
+	map->size = 0;
+}
+
+
+/*
+ * Asks the kernel to start reading a file we are going to hash next,
+ * so its pages are cached by the time the current file is done.
+ */
+void prefetch_file(const char *filename){
+	int fd;
+
+	if((fd = open(filename, O_RDONLY)) < 0)
+		return;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
@@ -20,9 +20,17 @@
  * Email: Frank.Breitinger@cased.de
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "../header/config.h"
 #include "../header/fingerprint.h"
+#include "../header/hashing.h"
 #include "../header/helper.h"
+#include "../header/util.h"
+#include "../header/profile.h"
+#include "../header/output.h"
+
+static void add_new_bloomfilter(FINGERPRINT *fp);
 
 /**
  * Initializes an empty Fingerprint
@@ -35,9 +43,23 @@ FINGERPRINT *init_empty_fingerprint(){
         exit(-1);
     }
 
-    fp->amount_of_BF       = 0;
-    fp->bf_list = init_empty_BF();
-    fp->bf_list_last_element = fp->bf_list;
+    fp->bf_array     = NULL;
+    fp->bf_blocks    = NULL;
+    fp->bf_bits_set  = NULL;
+    fp->bf_tail_bits = NULL;
+    fp->bf_capacity  = 0;
+
+    fp->chunk_hashes   = NULL;
+    fp->chunk_count    = 0;
+    fp->chunk_capacity = 0;
+    fp->chunks_kept    = (mode->min_shared_chunks > 0);
+    fp->mapped         = false;
+
+    fp->file_name[0] = '\0';
+    fp->filesize     = 0;
+
+    fp->amount_of_BF = 0;
+    add_new_bloomfilter(fp);
     fp->next = NULL;
     return fp;
 }
@@ -67,14 +89,16 @@ FINGERPRINT *init_fingerprint_for_file(FILE *handle, char *filename) {
  *  Destroys all filters and sets all memory free
  */
 int fingerprint_destroy(FINGERPRINT *fp) {
-	BLOOMFILTER *tmp, *node = fp->bf_list;	//start at the head.
-    while(node != NULL){					//traverse entire list.
-    	tmp = node;							//save node pointer
-    	node = node->next;					//advance to next.
-    	free(tmp);							//free the saved one.
+    if(fp->mapped) {
+    	free(fp);
+    	return 0;
     }
-    fp->bf_list = NULL;						//finally, mark as empty list.
-    fp->bf_list_last_element = NULL;
+
+    free(fp->bf_array);
+    free(fp->bf_blocks);
+    free(fp->bf_bits_set);
+    free(fp->bf_tail_bits);
+    free(fp->chunk_hashes);
 
 	free(fp);
     fp=NULL;
@@ -86,37 +110,144 @@ int fingerprint_destroy(FINGERPRINT *fp) {
  * Adds a block-hash to the fingerprint
  */
 void add_hash_to_fingerprint(FINGERPRINT *fp, uint64 hash_value){
-	BLOOMFILTER *lastBF = fp->bf_list_last_element;
-
 	//if MAXBLOCKS are within a Bloom filter than create a new one
-	if(lastBF->amount_of_blocks == MAXBLOCKS){
-		BLOOMFILTER *bf = init_empty_BF();
-		add_new_bloomfilter(fp, bf);
-		lastBF = bf;
-	}
+	if((uint32)fp->bf_blocks[fp->amount_of_BF] == profile->max_blocks)
+		add_new_bloomfilter(fp);
+
+	profile->add_hash_to_bloomfilter(fp, fp->amount_of_BF, hash_value);
 
-	add_hash_to_bloomfilter(lastBF, hash_value);
+	if(fp->chunks_kept)
+		add_chunk_hash(fp, hash_value);
+}
+
+void add_hash_to_bloomfilter(FINGERPRINT *fp, unsigned int bf, uint64 hash_value){
+	profile->add_hash_to_bloomfilter(fp, bf, hash_value);
 }
 
 
-//Adds a new last Bloom filter
-void add_new_bloomfilter(FINGERPRINT *fp, BLOOMFILTER *bf){
-	if(fp->bf_list==NULL) {
-		fp->bf_list = bf;
-		fp->bf_list_last_element = bf;
-	} else {
-		fp->bf_list_last_element->next = bf;
-		fp->bf_list_last_element = bf;
-		fp->amount_of_BF++;
+/*
+ * Makes room for amount Bloom filters. The filters are moved to a larger
+ * aligned block when they do not fit anymore.
+ */
+void reserve_bloomfilters(FINGERPRINT *fp, unsigned int amount){
+	unsigned char *array;
+
+	if(amount <= fp->bf_capacity)
+		return;
+	amount = MAX(amount, 2*fp->bf_capacity);
+
+	if(posix_memalign((void **)&array, FILTER_ALIGNMENT, (size_t)amount*profile->filter_size) != 0 ||
+			!(fp->bf_blocks    = (short *)realloc(fp->bf_blocks, amount*sizeof(short))) ||
+			!(fp->bf_bits_set  = (unsigned short *)realloc(fp->bf_bits_set, amount*sizeof(unsigned short))) ||
+			!(fp->bf_tail_bits = (unsigned short *)realloc(fp->bf_tail_bits, amount*sizeof(unsigned short)))) {
+		fprintf(stderr,"[*] Error in initializing bloom filters \n");
+		exit(-1);
 	}
+
+	if(fp->bf_array != NULL)
+		memcpy(array, fp->bf_array, (size_t)fp->bf_capacity*profile->filter_size);
+	free(fp->bf_array);
+	fp->bf_array = array;
+	fp->bf_capacity = amount;
+}
+
+/*
+ * Keeps the hash of a chunk for the candidate index (see chunk_index.h)
+ */
+void add_chunk_hash(FINGERPRINT *fp, uint64 hash_value){
+	if(fp->chunk_count == fp->chunk_capacity) {
+		fp->chunk_capacity = MAX(64, 2*fp->chunk_capacity);
+		if(!(fp->chunk_hashes = (uint64 *)realloc(fp->chunk_hashes, fp->chunk_capacity*sizeof(uint64)))) {
+			fprintf(stderr,"[*] Error in initializing chunk hashes \n");
+			exit(-1);
+		}
+	}
+	fp->chunk_hashes[fp->chunk_count++] = hash_value;
+}
+
+static int compare_uint64(const void *a, const void *b){
+	uint64 x = *(const uint64 *)a, y = *(const uint64 *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Sorts the chunk hashes and removes the duplicates; hashes that are
+ * already sorted and distinct, like those of a digest, are not written to
+ */
+void sort_chunk_hashes(FINGERPRINT *fp){
+	unsigned int i, distinct = 0;
+
+	for(i=1; i<fp->chunk_count && fp->chunk_hashes[i-1] < fp->chunk_hashes[i]; i++);
+	if(i >= fp->chunk_count)
+		return;
+
+	qsort(fp->chunk_hashes, fp->chunk_count, sizeof(uint64), compare_uint64);
+	for(i=0; i<fp->chunk_count; i++)
+		if(distinct == 0 || fp->chunk_hashes[i] != fp->chunk_hashes[distinct-1])
+			fp->chunk_hashes[distinct++] = fp->chunk_hashes[i];
+	fp->chunk_count = distinct;
+}
+
+/*
+ * Sparse last filters: the last filter of a fingerprint holds fewer than
+ * MAXBLOCKS blocks, and that of a small file often only a few dozen bits.
+ * Binary digest files store it as the positions of its bits, a fraction of
+ * its dense size. In memory it is dense again: testing a few dozen positions
+ * costs more than the AND-popcount of a whole filter.
+ */
+bool is_sparse_filter(unsigned int bits_set){
+	return bits_set*SPARSE_FILTER_DENSITY <= profile->filter_size*8;
+}
+
+/*
+ * Writes the positions of the bits set in filter in ascending order and
+ * returns their number
+ */
+unsigned int collect_positions(const unsigned char *filter, unsigned short *positions){
+	unsigned int amount = 0, byte, bit;
+
+	for(byte=0; byte<profile->filter_size; byte++)
+		for(bit=0; filter[byte] >> bit; bit++)
+			if((filter[byte] >> bit) & 1)
+				positions[amount++] = byte*8 + bit;
+	return amount;
+}
+
+void expand_positions(const unsigned short *positions, unsigned int amount, unsigned char *filter){
+	unsigned int i;
+
+	memset(filter, 0, profile->filter_size);
+	for(i=0; i<amount; i++)
+		filter[positions[i] >> 3] |= 1 << (positions[i] & 7);
+}
+
+//Adds a new, empty last Bloom filter
+static void add_new_bloomfilter(FINGERPRINT *fp){
+	unsigned int bf = (fp->bf_array == NULL) ? 0 : fp->amount_of_BF+1;
+
+	reserve_bloomfilters(fp, bf+1);
+	memset(&fp->bf_array[(size_t)bf*profile->filter_size], 0, profile->filter_size);
+	fp->bf_blocks[bf]    = 0;
+	fp->bf_bits_set[bf]  = 0;
+	fp->bf_tail_bits[bf] = 0;
+	fp->amount_of_BF = bf;
 }
 
 
 // Compares two fingerprints and returns a match-score between 0 and 100
 int fingerprint_compare(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2) {
+    return fingerprint_compare_bound(fingerprint1, fingerprint2, 0);
+}
+
+/*
+ * Like fingerprint_compare(), but only scores of at least min_score matter:
+ * the result is exact if it is at least min_score and below it otherwise,
+ * which lets hopeless pairs be abandoned early.
+ */
+int fingerprint_compare_bound(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2, int min_score) {
 
     int final_score = 0;
-    int i, amount_of_BF;
+    int i, amount_of_BF, scored_BF, need;
 
     FINGERPRINT *larger_fingerprint = fingerprint1;
     FINGERPRINT *smaller_fingerprint = fingerprint2;
@@ -130,13 +261,13 @@ int fingerprint_compare(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2) {
     //In case of file-comparsion we need the bigger value
     if(mode->file_comparison){
     	amount_of_BF =larger_fingerprint->amount_of_BF+1;
-    	if(larger_fingerprint->bf_list_last_element->amount_of_blocks < MINBLOCKS)
+    	if(larger_fingerprint->bf_blocks[larger_fingerprint->amount_of_BF] < MINBLOCKS)
     		amount_of_BF--;
     }
 
     else {
     	amount_of_BF = smaller_fingerprint->amount_of_BF+1;
-    	if(smaller_fingerprint->bf_list_last_element->amount_of_blocks < MINBLOCKS)
+    	if(smaller_fingerprint->bf_blocks[smaller_fingerprint->amount_of_BF] < MINBLOCKS)
     			amount_of_BF--;
     }
 
@@ -148,12 +279,23 @@ int fingerprint_compare(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2) {
 
     //run through all bloom filters of the smaller fingerprint and compare them
     //to all fingerprints of the large one
-    BLOOMFILTER *bf = smaller_fingerprint->bf_list;
-    for(i=0;i<=smaller_fingerprint->amount_of_BF;i++) {
-    	if(bf->amount_of_blocks < MINBLOCKS) 	//there is no sense in comparing Bloom filters having less than 6 Blocks
+    //the filters scored: all up to the last one if it has less than MINBLOCKS
+    scored_BF = smaller_fingerprint->amount_of_BF+1;
+    if(smaller_fingerprint->bf_blocks[smaller_fingerprint->amount_of_BF] < MINBLOCKS)
+    	scored_BF--;
+
+    for(i=0;i<=(int)smaller_fingerprint->amount_of_BF;i++) {
+    	if(smaller_fingerprint->bf_blocks[i] < MINBLOCKS) 	//there is no sense in comparing Bloom filters having less than 6 Blocks
     		break;
-    	final_score += bloom_max_score(bf, larger_fingerprint);        //final_score += bloom_max_score(filter_ptr[i], bloom_less_elements->count_added_blocks[i], bloom_more_elements);
-    	bf = bf->next;
+
+    	//score filter i needs to reach min_score if all later ones score 100
+    	need = 0;
+    	if(min_score > 0 && amount_of_BF >= 1) {
+    		need = min_score*amount_of_BF - final_score - 100*(scored_BF-i-1);
+    		if(need > 100)
+    			return 0;
+    	}
+    	final_score += profile->bloom_max_score(smaller_fingerprint, i, larger_fingerprint, MAX(need, 0));
     }
 
 
@@ -164,88 +306,44 @@ int fingerprint_compare(FINGERPRINT *fingerprint1, FINGERPRINT *fingerprint2) {
 
 }
 
-int bloom_max_score(BLOOMFILTER *bf, FINGERPRINT *fingerprint) {
-    int    C, i, e_min, e_max;
-    int tmp_score = 0;
-    int score     = 0;
-
-    int bitsSetOfBF1 = count_bits_set_to_one_of_BF(bf->array);
-
-    BLOOMFILTER *tmp_bf = fingerprint->bf_list;
-
-    e_min = compute_e_min(bf->amount_of_blocks, tmp_bf->amount_of_blocks);
-
-    for(i=0;i<=fingerprint->amount_of_BF;i++) {
-
-    	//Filters with 6 or less elements are critical
-    	if(tmp_bf->amount_of_blocks < MINBLOCKS){
-    		//if(i > 0 || (mode->ignoreSmallInputs)) //&& bf->amount_of_blocks > 40))
-    				return score;
-    	}
-
-    	//for the last Bloom filter we have to update the values
-       	if(tmp_bf->next == NULL) {
-           	e_min = compute_e_min(tmp_bf->amount_of_blocks, bf->amount_of_blocks);
-        }
-
-       	e_max = MIN(bitsSetOfBF1, count_bits_set_to_one_of_BF(tmp_bf->array));
-   	    C = 0.3*(e_max - e_min)+e_min;
-
-       	//compute bits in common
-        unsigned int numofbitsInCommon = bloom_common_bits(tmp_bf->array, bf->array);
-
-      	 if(numofbitsInCommon > C)
-      		 printf("");
-
-        //if they are high enough we have a threshold
-        if(numofbitsInCommon < C) {
-            tmp_score = 0;
-        } else {
-        	if ((e_max - C) >= 1)
-        		tmp_score = 100*(numofbitsInCommon-C)/(e_max-C);
-        }
-
-        if(score < tmp_score){
-            score = tmp_score;
-            if(score == 100)
-            	break;
-        }
-
-        tmp_bf = tmp_bf->next;
-    }
-    return score;
+int bloom_max_score(FINGERPRINT *fp, unsigned int bf, FINGERPRINT *fingerprint) {
+    return profile->bloom_max_score(fp, bf, fingerprint, 0);
 }
 
 
 double compute_e_min(int blocks_in_bf1, int blocks_in_bf2){
-	int b1 = blocks_in_bf1;
-	int b2 = blocks_in_bf2;
-
-	double tmp1 = pow(PROBABILITY, SUBHASHES*b1);
-	double tmp2 = pow(PROBABILITY, SUBHASHES*b2);
-	double tmp3 = pow(PROBABILITY, SUBHASHES*(b1+b2));
-
-	return BLOOMFILTERBITSIZE*(1 - tmp1 - tmp2 + tmp3);
-	//return BLOOMFILTERBITSIZE * (1-pow(bloom->probability,5*blocks)-pow(bloom->probability,5*blocks)+pow(tmp_bf->probability,5*(blocks+tmp_bf->count_added_blocks[i])))
+	return profile->compute_e_min(blocks_in_bf1, blocks_in_bf2);
 }
 
 void print_fingerprint(FINGERPRINT *fp){
-    int j;
-    BLOOMFILTER *bf = fp->bf_list;
-
-    /* FORMAT: filename:filesize:number of filters:blocks in last filter*/
-    printf("%s:%d:%d:%d", fp->file_name, fp->filesize, fp->amount_of_BF, fp->bf_list_last_element->amount_of_blocks);
-    printf(":");
+    size_t j;
 
-    while(bf != NULL) {
-    	//Print each Bloom filter as a 2-digit-hex value
-    	for(j=0;j<FILTERSIZE;j++)
-        	printf("%02X", bf->array[j]);
+    OUTPUT_BUFFER *out = &standard_output;
 
-       //move to next Bloom filter
-       bf = bf->next;
+    /* FORMAT: filename:filesize:number of filters:blocks in last filter*/
+    output_string(out, fp->file_name);
+    output_bytes(out, ":", 1);
+    output_decimal(out, (long long)fp->filesize, 1);
+    output_bytes(out, ":", 1);
+    output_decimal(out, fp->amount_of_BF, 1);
+    output_bytes(out, ":", 1);
+    output_decimal(out, fp->bf_blocks[fp->amount_of_BF], 1);
+    output_bytes(out, ":", 1);
+
+    //Print each Bloom filter as a 2-digit-hex value
+    output_hex(out, fp->bf_array, (size_t)(fp->amount_of_BF+1)*profile->filter_size);
+
+    //Digest extension of -k: number of chunk hashes and each as 16-digit-hex value
+    if(fp->chunks_kept) {
+    	sort_chunk_hashes(fp);
+    	output_bytes(out, ":", 1);
+    	output_decimal(out, fp->chunk_count, 1);
+    	output_bytes(out, ":", 1);
+    	for(j=0;j<fp->chunk_count;j++)
+    		output_hex64(out, fp->chunk_hashes[j]);
     }
-    printf("\n\n");
+    output_bytes(out, "\n\n", 2);
+    end_output_record(out);
 
 }
 
@@ -255,9 +353,7 @@ void print_fingerprint(FINGERPRINT *fp){
  * */
 int init_fingerprint_for_file_NO_BF(FILE *handle, char *filename, sqlite3 *db) {
 
-    unsigned int size = find_file_size(handle);
-
-    int num_features = hashFile_features_extraction(size, filename, handle, db);
+    int num_features = hashFile_features_extraction(filename, handle, db);
 
     fclose(handle);
 
@@ -269,9 +365,7 @@ int init_fingerprint_for_file_NO_BF(FILE *handle, char *filename, sqlite3 *db) {
  * */
 int init_fingerprint_for_file_checking(FILE *handle, char *filename, sqlite3 *db) {
 
-    unsigned int size = find_file_size(handle);
-
-    int num_features = hashFile_features_extraction_checking(size, filename, handle, db);
+    int num_features = hashFile_features_extraction_checking(filename, handle, db);
 
     fclose(handle);
 
@@ -282,15 +376,13 @@ int init_fingerprint_for_file_checking(FILE *handle, char *filename, sqlite3 *db
 /**
  * Feature extraction using a fixed-size sliding window
  * */
-void init_fingerprint_for_file_NO_BF_NO_CONTEXT(FILE *handle, char *filename) {
+int init_fingerprint_for_file_NO_BF_NO_CONTEXT(FILE *handle, char *filename, sqlite3 *db) {
 
-    unsigned int size = find_file_size(handle);
-
-    hashFile_features_extraction_no_context(size, filename, handle);
+    int num_features = hashFile_features_extraction_no_context(filename, handle, db);
 
     fclose(handle);
 
-    return;
+    return num_features;
 }
 
 
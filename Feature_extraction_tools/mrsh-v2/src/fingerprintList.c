@@ -4,6 +4,7 @@
  * Email: Frank.Breitinger@cased.de
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h> 			//is important for strtok!!
 
 #include <unistd.h>
@@ -13,7 +14,17 @@
 
 #include "../header/config.h"
 #include "../header/fingerprintList.h"
+#include "../header/parallel_compare.h"
+#include "../header/parallel_loading.h"
+#include "../header/chunk_index.h"
+#include "../header/digest_file.h"
 #include "../header/helper.h"
+#include "../header/profile.h"
+#include "../header/bloomfilter.h"
+#include "../header/output.h"
+
+//fields of a text digest line, see read_fingerprint_file()
+#define DIGEST_FIELDS   7
 
 
 /**
@@ -29,6 +40,9 @@ FINGERPRINT_LIST *init_empty_fingerprintList(){
 	fpl->list = NULL;
 	fpl->last_element = NULL;
     fpl->size   = 0;
+    fpl->digest_file = NULL;
+    fpl->filter_weights = NULL;
+    fpl->expanded_filters = NULL;
     return fpl;
 }
 
@@ -36,7 +50,14 @@ FINGERPRINT_LIST *init_empty_fingerprintList(){
 FINGERPRINT_LIST *init_fingerprintList_for_ListFile(char *filename){
 	FINGERPRINT_LIST *fpl = init_empty_fingerprintList();
 	FILE *file = getFileHandle(filename);
-	read_fingerprint_file(fpl, file);
+
+	setvbuf(file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+
+	//both formats are loaded with -j threads
+	if(is_digest_file(file))
+		read_digest_file(fpl, file, mode->threads);
+	else if(mode->threads <= 1 || read_fingerprint_file_parallel(fpl, file, mode->threads) != 0)
+		read_fingerprint_file(fpl, file);
 	return fpl;
 }
 
@@ -56,6 +77,14 @@ int fingerprintList_destroy(FINGERPRINT_LIST *fpl) {
     fpl->list = NULL;						//finally, mark as empty list.
     fpl->last_element = NULL;
 
+    //the fingerprints of a digest file point into it
+    if(fpl->digest_file != NULL) {
+    	release_file(fpl->digest_file);
+    	free(fpl->digest_file);
+    	free(fpl->filter_weights);
+    	free(fpl->expanded_filters);
+    }
+
 	free(fpl);
     fpl=NULL;
     return 0;
@@ -77,6 +106,134 @@ void add_new_fingerprint(FINGERPRINT_LIST *fpl, FINGERPRINT *fp){
 }
 
 
+/*
+ * Top-K mode (-n): only the mode->top_k best matches of each query are
+ * printed, best first and earlier ones first on equal scores. The matches
+ * are kept in a min-heap whose root is the worst of them; once it is full,
+ * a candidate must beat the root, which is pushed down into the comparison
+ * as its minimum score.
+ */
+typedef struct {
+	int			score;
+	uint32		rank;		//position in the list
+	FINGERPRINT	*fp;
+}TOP_MATCH;
+
+static bool worse_match(const TOP_MATCH *a, const TOP_MATCH *b){
+	return a->score < b->score || (a->score == b->score && a->rank > b->rank);
+}
+
+static void push_match(TOP_MATCH *heap, int *size, TOP_MATCH match){
+	int i, child;
+
+	if(*size < mode->top_k) {
+		//sift up from the new leaf
+		for(i=(*size)++; i > 0 && worse_match(&match, &heap[(i-1)/2]); i=(i-1)/2)
+			heap[i] = heap[(i-1)/2];
+		heap[i] = match;
+		return;
+	}
+	if(!worse_match(&heap[0], &match))
+		return;
+
+	//replace the root and sift it down
+	for(i=0; (child = 2*i+1) < *size; i=child) {
+		if(child+1 < *size && worse_match(&heap[child+1], &heap[child]))
+			child++;
+		if(!worse_match(&heap[child], &match))
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = match;
+}
+
+static int compare_matches(const void *a, const void *b){
+	return worse_match((const TOP_MATCH *)a, (const TOP_MATCH *)b) ? 1 : -1;
+}
+
+/*
+ * Prints the best matches of query among list and the fingerprints after it;
+ * query is skipped if it is one of them. With query_first query is the first
+ * fingerprint of each comparison and line.
+ */
+static void top_matches(FINGERPRINT *query, FINGERPRINT *list, bool query_first, TOP_MATCH *heap){
+	FINGERPRINT *tmp;
+	TOP_MATCH match;
+	int size = 0, min_score, i;
+	uint32 rank = 0;
+
+	for(tmp=list; tmp != NULL; tmp=tmp->next, rank++) {
+		if(tmp == query)
+			continue;
+
+		//a later match needs to beat the worst one kept
+		min_score = mode->threshold;
+		if(size == mode->top_k)
+			min_score = MAX(min_score, heap[0].score+1);
+
+		match.score = query_first ? fingerprint_compare_bound(query, tmp, min_score)
+								  : fingerprint_compare_bound(tmp, query, min_score);
+		if(match.score < min_score)
+			continue;
+		match.rank = rank;
+		match.fp = tmp;
+		push_match(heap, &size, match);
+	}
+
+	qsort(heap, size, sizeof(TOP_MATCH), compare_matches);
+	for(i=0; i<size; i++) {
+		if(query_first)
+			output_match(&standard_output, query->file_name, heap[i].fp->file_name, heap[i].score);
+		else
+			output_match(&standard_output, heap[i].fp->file_name, query->file_name, heap[i].score);
+	}
+}
+
+static TOP_MATCH *init_top_matches(){
+	TOP_MATCH *heap;
+
+	if (!(heap=(TOP_MATCH *)malloc(mode->top_k*sizeof(TOP_MATCH)))) {
+        fprintf(stderr,"[*] Error in initializing top matches \n");
+        exit(-1);
+    }
+	return heap;
+}
+
+/*
+ * Prints the best matches of each fingerprint of fpl among all others
+ */
+static void top_matches_of_each(FINGERPRINT_LIST *fpl){
+	TOP_MATCH *heap = init_top_matches();
+	PACKED_LIST packed;
+	uint32 i;
+
+	//the list is scanned once per fingerprint, so it is packed first
+	pack_list(fpl, &packed);
+	for(i=0; i<packed.amount; i++)
+		top_matches(&packed.fps[i], packed.fps, true, heap);
+
+	free_packed_list(&packed);
+	free(heap);
+}
+
+/*
+ * Prints the best matches in fpl1 of each fingerprint of fpl2, the queries;
+ * fpl1 is packed once and scanned for all of them
+ */
+static void top_matches_of_queries(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2){
+	TOP_MATCH *heap = init_top_matches();
+	PACKED_LIST packed;
+	FINGERPRINT *query;
+
+	pack_list(fpl1, &packed);
+	for(query=fpl2->list; query != NULL && packed.amount > 0; query=query->next)
+		top_matches(query, packed.fps, false, heap);
+
+	free_packed_list(&packed);
+	free(heap);
+}
+
+
 /*
  * Does an all-against-all comparison of the list
  * but does not compare the file with itself.
@@ -85,12 +242,27 @@ void all_against_all_comparsion(FINGERPRINT_LIST *fpl){
    int score;
    FINGERPRINT *tmp2, *tmp1 = fpl->list;
 
+   //the best matches of each file among all others
+   if(mode->top_k > 0) {
+	   top_matches_of_each(fpl);
+	   return;
+   }
+
+   if(mode->min_shared_chunks > 0) {
+	   if(all_against_all_indexed(fpl, mode->min_shared_chunks) == 1)
+		   return;
+	   fprintf(stderr,"[*] Warning: not all digests have chunk hashes (-k), comparing all pairs \n");
+   }
+
+   if(mode->threads > 1 && all_against_all_parallel(fpl, mode->threads, mode->ordered_output) == 1)
+	   return;
+
    while(tmp1 != NULL){
 	   FINGERPRINT *tmp2 = tmp1->next;
 	   while(tmp2 != NULL){
-		    score=fingerprint_compare(tmp1, tmp2);
+		    score=fingerprint_compare_bound(tmp1, tmp2, mode->threshold);
 	         if(score >= mode->threshold)
-	               printf("%s | %s | %.3i \n", tmp1->file_name, tmp2->file_name, score);
+	               output_match(&standard_output, tmp1->file_name, tmp2->file_name, score);
 	         tmp2=tmp2->next;
 	   }
 	   tmp1=tmp1->next;
@@ -105,12 +277,27 @@ void fingerprint_list_comparsion(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2)
    int score;
    FINGERPRINT *tmp1 = fpl1->list;
 
+   //the best matches in fpl1 of each file of fpl2
+   if(mode->top_k > 0) {
+	   top_matches_of_queries(fpl1, fpl2);
+	   return;
+   }
+
+   if(mode->min_shared_chunks > 0) {
+	   if(list_against_list_indexed(fpl1, fpl2, mode->min_shared_chunks) == 1)
+		   return;
+	   fprintf(stderr,"[*] Warning: not all digests have chunk hashes (-k), comparing all pairs \n");
+   }
+
+   if(list_against_list_parallel(fpl1, fpl2, mode->threads, mode->ordered_output) == 1)
+	   return;
+
    while(tmp1 != NULL){
 	   FINGERPRINT *tmp2 = fpl2->list;
 	   while(tmp2 != NULL){
-		    score=fingerprint_compare(tmp1, tmp2);
+		    score=fingerprint_compare_bound(tmp1, tmp2, mode->threshold);
 	         if(score >= mode->threshold)
-	               printf("%s | %s | %.3i \n", tmp1->file_name, tmp2->file_name, score);
+	               output_match(&standard_output, tmp1->file_name, tmp2->file_name, score);
 	         tmp2=tmp2->next;
 	   }
 	   tmp1=tmp1->next;
@@ -124,10 +311,17 @@ void fingerprint_against_list_comparison(FINGERPRINT_LIST *fpl, FINGERPRINT *fp)
    int score;
    FINGERPRINT *tmp1 = fpl->list;
 
+   if(mode->top_k > 0) {
+	   TOP_MATCH *heap = init_top_matches();
+	   top_matches(fp, fpl->list, false, heap);
+	   free(heap);
+	   return;
+   }
+
    while(tmp1 != NULL){
-	     score=fingerprint_compare(tmp1, fp);
+	     score=fingerprint_compare_bound(tmp1, fp, mode->threshold);
 	         if(score >= mode->threshold)
-	               printf("%s | %s | %.3i \n", tmp1->file_name, fp->file_name, score);
+	               output_match(&standard_output, tmp1->file_name, fp->file_name, score);
 	   tmp1=tmp1->next;
    }
 }
@@ -144,109 +338,139 @@ void print_fingerprintList(FINGERPRINT_LIST *fpl){
 
 
 /*
- * Reads a fingerprint file and stores it in the fingerprint list
+ * Splits line at each ':' like strtok(): empty fields are skipped. Returns
+ * the number of fields; only the first DIGEST_FIELDS are stored.
  */
-unsigned int read_fingerprint_file(FINGERPRINT_LIST *fpl, FILE *handle){
-	unsigned int bytes_read;
-    size_t nbytes = 5000;
-    unsigned char *hex_string, *tokenize, *string_read;   	//the hex string of the hash
-    char delims[] = ":"; 									//separator for the fingerprints in the file
-    int amount_of_BF=0, blocks_in_last_bf=0;
-
-
-    //hex needs to be doubled because 2 characters is one hex value
-    unsigned char *hex = (unsigned char *) malloc(FILTERSIZE*2 +1);
-
-    /*Main lines for a glibc getline function*/
-    /*getline is only for *nix machines. uses glibc. more reliable and reallocates the memory of the buffer while reading*/
-    while(!feof(handle)){
-    	string_read =( unsigned char *) malloc(nbytes +1);
-        bytes_read = getline(&string_read, &nbytes, handle);
-
-
-        //error handling
-        if(bytes_read == -1) {
-            free(string_read);
-            break;
-        } else if(!strcmp(string_read, " ") || !strcmp(string_read,"\n")) {
-            continue;
-        } else {
-           //parse the string read and extract the hashed hexadecimal string
-            /*strtok is used for tokenizing the string (separation delims)*/
-            FINGERPRINT *fp = init_empty_fingerprint();
-            add_new_fingerprint(fpl, fp);
-
-            tokenize = strtok(string_read,delims);
-
-            int counter = 0;
-            while(tokenize !=NULL){
-                switch(counter) {
-                    case 0:
-                        /*get the filename*/
-                        strcpy(fp->file_name, tokenize); break;
-
-                    case 1:
-                        /*get the filesize*/
-                        fp->filesize = atoi(tokenize); break;
-
-                    case 2:
-                        /*get the count of the filters*/
-                        amount_of_BF= atoi(tokenize); break;
-
-                    case 3:
-                        /* only the last block of the filter have less than max blocks*/
-                    	blocks_in_last_bf = atoi(tokenize); break;
-
-                    case 4:
-                    	/* hex_string is then the fingerprint */
-                        hex_string =(unsigned char*) calloc((strlen(tokenize)+1), sizeof(unsigned char));
-                        strcpy(hex_string, tokenize);
-                        break;
-
-                    default:
-                        fprintf(stderr, "[*] ERROR IN PARSING FILE CONTENT OF HASH FILE");
-                        break;
-                }
-                tokenize= strtok(NULL, delims);
-                counter++;
-            }
-
-
-           if(hex_string!=NULL){
-
-        	   //Reset bf_list when we read in a LIST
-        	   fp->bf_list = NULL;
-        	   fp->bf_list_last_element = NULL;
-
-        	   for(int i=0; i<=amount_of_BF;i++){
-        		   //create a Bloom filter and add it to the fingerprint
-        		   BLOOMFILTER *bf = init_empty_BF();
-        		   add_new_bloomfilter(fp, bf);
-
-        		   //fill Bloom filter with the hex digest
-        		   //example: void * memcpy ( void * destination, const void * source, size_t num );
-        		   memcpy(hex, &hex_string[FILTERSIZE*2*i], FILTERSIZE*2);
-        		   convert_hex_binary(hex, bf);
-
-        		   bf->amount_of_blocks = MAXBLOCKS;
-       		    }
-
-        	   //The last Bloom filter may not have MAXBLOCKS --> update it
-        	   fp->bf_list_last_element->amount_of_blocks = blocks_in_last_bf;
-
-        	   free(hex_string);
-        	   hex_string=NULL;
-            }
-
-
-           if(string_read!=NULL){
-                free(string_read);
-                string_read=NULL;
-            }
-    }
-    }
-	fclose(handle);
-    return 1;
+static int split_fields(char *line, char **field, size_t *length){
+	int fields = 0;
+	char *end;
+
+	for(;;) {
+		while(*line == ':')
+			line++;
+		if(*line == '\0')
+			return fields;
+		for(end=line; *end != ':' && *end != '\0'; end++);
+
+		if(fields < DIGEST_FIELDS) {
+			field[fields] = line;
+			length[fields] = end-line;
+		}
+		fields++;
+		if(*end == '\0')
+			return fields;
+		*end = '\0';
+		line = end+1;
+	}
 }
 
+/*
+ * Decodes the filters of a digest straight into the fingerprint
+ */
+static void parse_filters(FINGERPRINT *fp, const char *hex, size_t length, int amount_of_BF, int blocks_in_last_bf){
+	size_t bytes = (size_t)(amount_of_BF+1)*profile->filter_size;
 
+	if(amount_of_BF < 0) {
+		fprintf(stderr, "[*] ERROR IN PARSING FILE CONTENT OF HASH FILE");
+		return;
+	}
+
+	reserve_bloomfilters(fp, amount_of_BF+1);
+	fp->amount_of_BF = amount_of_BF;
+
+	//a short digest leaves the rest of its filters empty
+	if(length < 2*bytes) {
+		fprintf(stderr, "[*] ERROR IN PARSING FILE CONTENT OF HASH FILE");
+		memset(fp->bf_array, 0, bytes);
+		bytes = length/2;
+	}
+	decode_hex((const unsigned char *)hex, fp->bf_array, bytes);
+
+	for(int i=0; i<=amount_of_BF; i++){
+		fp->bf_blocks[i] = profile->max_blocks;
+		fp->bf_bits_set[i] = profile->filter_weights(&fp->bf_array[(size_t)i*profile->filter_size], &fp->bf_tail_bits[i]);
+	}
+
+	//The last Bloom filter may not have MAXBLOCKS --> update it
+	fp->bf_blocks[amount_of_BF] = blocks_in_last_bf;
+}
+
+/*
+ * Decodes the chunk hashes of the -k extension, 16 hex digits each
+ */
+static void parse_chunk_hashes(FINGERPRINT *fp, const char *hex, size_t length, unsigned int chunk_count){
+	if(length < (size_t)chunk_count*16) {
+		fprintf(stderr, "[*] ERROR IN PARSING CHUNK HASHES OF %s \n", fp->file_name);
+		chunk_count = length/16;
+	}
+
+	if(chunk_count > fp->chunk_capacity) {
+		fp->chunk_capacity = chunk_count;
+		if(!(fp->chunk_hashes = (uint64 *)realloc(fp->chunk_hashes, chunk_count*sizeof(uint64)))) {
+			fprintf(stderr,"[*] Error in initializing chunk hashes \n");
+			exit(-1);
+		}
+	}
+	for(unsigned int i=0; i<chunk_count; i++)
+		fp->chunk_hashes[i] = decode_hex64((const unsigned char *)&hex[16*i]);
+	fp->chunk_count = chunk_count;
+	sort_chunk_hashes(fp);
+}
+
+/*
+ * Parses one line of a text digest list, which is changed in place. A line
+ * is filename:filesize:number of filters:blocks in last filter:hex filters,
+ * plus :number of chunk hashes:hex chunk hashes with -k. Returns NULL for
+ * a blank line.
+ */
+FINGERPRINT *parse_digest_line(char *line){
+	char *field[DIGEST_FIELDS];
+	size_t length[DIGEST_FIELDS];
+	int fields, k;
+
+	if(!strcmp(line, " ") || !strcmp(line,"\n"))
+		return NULL;
+
+	FINGERPRINT *fp = init_empty_fingerprint();
+	fp->chunks_kept = false;
+
+	fields = split_fields(line, field, length);
+	for(k=DIGEST_FIELDS; k<fields; k++)
+		fprintf(stderr, "[*] ERROR IN PARSING FILE CONTENT OF HASH FILE");
+
+	if(fields > 0) {
+		length[0] = MIN(length[0], sizeof(fp->file_name)-1);
+		memcpy(fp->file_name, field[0], length[0]);
+		fp->file_name[length[0]] = '\0';
+	}
+	if(fields > 1)
+		fp->filesize = strtoull(field[1], NULL, 10);
+	if(fields > 4)
+		parse_filters(fp, field[4], length[4], atoi(field[2]), atoi(field[3]));
+
+	//digest extension of -k
+	if(fields > 5)
+		fp->chunks_kept = true;
+	if(fields > 6)
+		parse_chunk_hashes(fp, field[6], length[6], strtoul(field[5], NULL, 10));
+	return fp;
+}
+
+/*
+ * Reads a fingerprint file and stores it in the fingerprint list. One line
+ * buffer is used for the whole file and the fields are parsed in place.
+ */
+unsigned int read_fingerprint_file(FINGERPRINT_LIST *fpl, FILE *handle){
+	char *line = NULL;
+	size_t capacity = 0;
+	FINGERPRINT *fp;
+
+	while(getline(&line, &capacity, handle) != -1){
+		if((fp = parse_digest_line(line)) != NULL)
+			add_new_fingerprint(fpl, fp);
+	}
+
+	free(line);
+	fclose(handle);
+	return 1;
+}
@@ -18,24 +18,25 @@
 #include "../header/util_sql.h"
 #include "../header/config.h"
 #include "../header/util.h"
+#include "../header/filemap.h"
+#include "../header/chunker.h"
+#include "../header/parallel_hashing.h"
+#include "../header/profile.h"
 #include <stdio.h>
+#include <fcntl.h>
 #include <openssl/md5.h>
 #include <string.h>
 #include <sqlite3.h> 
 #include <libgen.h> // fix segmentation fault caused by basename()
 
-struct features_obj{
-	char hash[40];
-	char offset[20];
-	unsigned int size;
-	struct features_obj *next;
-};
+// multiplier of the rolling hash of the fixed-size windows (-s)
+#define WINDOW_PRIME            0x100000001b3ULL
 
-struct feature_set{
-	int id_obj; 
-	struct features_obj *feature_set; 
-	sqlite3 *db;
-};
+// fixed-size window features written to the database at once
+#define FIXED_WINDOW_BATCH      (1 << 16)
+
+// features of the file being extracted, one buffer per thread
+static __thread FEATURE_BUFFER feature_buffer;
 
 uint32 roll_hashx(unsigned char c, uchar window[], uint32 rhData[])
 {
@@ -74,113 +75,171 @@ uint32 djb2x(unsigned char c, uchar window[], unsigned int n)
 }
 
 
-int hashFileToFingerprint(FINGERPRINT *fingerprint, FILE *handle)
+static void init_chunk_state(CHUNK_STATE *st, uint64 filesize)
 {
-    unsigned long  bytes_read;   //stores the number of characters read from input file
-    unsigned int   i;
-    unsigned char  *byte_buffer     = NULL;
-    unsigned int last_block_index = 0;
-    uint64 rValue, hashvalue=0;
+    init_rolling_state(&st->rs, filesize);
+    st->hashvalue = FNV64_INIT;
+    st->first = 1;
+    st->ended = 0;
+}
 
-    /*we need this arrays for our extended rollhash function*/
-    uchar window[ROLLING_WINDOW] = {0};
-    uint32 rhData[4]             = {0};
+/*
+ * Runs the chunker over the next bytes of a file and adds every finished
+ * block to the fingerprint. The block still open at the end of the window
+ * stays in the state.
+ */
+static void hash_window(CHUNK_STATE *st, FINGERPRINT *fingerprint, const unsigned char *buffer, size_t length)
+{
+    size_t ends[CHUNK_BATCH];
+    uint64 hashes[CHUNK_BATCH];
+    size_t amount, scanned, block_start, j;
+    uint64 offset;
 
-    if((byte_buffer = (unsigned char*)malloc(sizeof(unsigned char)*fingerprint->filesize))==NULL)
-        return -1;
+    while(length > 0)
+    {
+        offset = st->rs.offset;
+        amount = find_chunk_ends(&st->rs, buffer, length, ends, CHUNK_BATCH, &scanned);
+        hash_chunks(buffer, ends, amount, st->hashvalue, hashes);
+
+        for(j=0; j<amount; j++) {
+            #ifdef network
+            if (st->first == 1) {
+                st->first=0;
+                continue;
+            }
+            #endif
+            add_hash_to_fingerprint(fingerprint, hashes[j]);
+        }
 
-    // bytes_read stores the number of characters we read from our file
-    fseek(handle,0L, SEEK_SET);	
-    if((bytes_read = fread(byte_buffer,sizeof(unsigned char),fingerprint->filesize,handle))==0)
-        return -1;
+        block_start = 0;
+        if(amount > 0) {
+            st->hashvalue = FNV64_INIT;
+            st->last_end = offset + ends[amount-1];
+            st->ended = 1;
+            block_start = ends[amount-1]+1;
+        }
+        st->hashvalue = fnv64Bit_update(st->hashvalue, &buffer[block_start], scanned-block_start);
 
-    short first = 1;
+        buffer += scanned;
+        length -= scanned;
+    }
+}
 
-    for(i=0; i<bytes_read; i++)
-    {
-        /*  
-         * rValue = djb2x(byte_buffer[i],window,i);  
-         */ 
-        rValue  = roll_hashx(byte_buffer[i], window, rhData);  
 
-        if (rValue % BLOCK_SIZE == BLOCK_SIZE-1) // || chunk_index >= BLOCK_SIZE_MAX)
-        {
+void hash_context_init(HASH_CONTEXT *ctx, FINGERPRINT *fingerprint, uint64 length)
+{
+    ctx->fingerprint = fingerprint;
+    ctx->length = length;
+    init_chunk_state(&ctx->st, (length == STREAM_LENGTH_UNKNOWN) ? UINT64_MAX : length);
+    memset(ctx->tail, 0, sizeof(ctx->tail));
+}
 
-        	#ifdef network
-        	if (first == 1){
-        		first=0;
-        		last_block_index = i+1;
-        		if(i+SKIPPED_BYTES < bytes_read)
-        		       i += SKIPPED_BYTES;
-        		continue;
-        	}
-			#endif
+void hash_context_update(HASH_CONTEXT *ctx, const unsigned char *data, size_t length)
+{
+    hash_window(&ctx->st, ctx->fingerprint, data, length);
 
-        	hashvalue = fnv64Bit(byte_buffer, last_block_index, i); //,current_index, FNV1_64_INIT);
-	       	add_hash_to_fingerprint(fingerprint, hashvalue); //printf("%i %llu \n", i, hashvalue);
+    //the last bytes are needed by hash_context_final() if the length is unknown
+    if(ctx->length != STREAM_LENGTH_UNKNOWN)
+        return;
 
-            last_block_index = i+1;
+    if(length >= STREAM_TAIL) {
+        memcpy(ctx->tail, &data[length-STREAM_TAIL], STREAM_TAIL);
+    } else {
+        memmove(ctx->tail, &ctx->tail[length], STREAM_TAIL-length);
+        memcpy(&ctx->tail[STREAM_TAIL-length], data, length);
+    }
+}
 
-            if(i+SKIPPED_BYTES < bytes_read)
-            	i += SKIPPED_BYTES;
-        }
+/*
+ * Adds the open block to the fingerprint. Returns -1 if no data was hashed.
+ *
+ * Without the length in advance every block end was followed by a jump of
+ * SKIPPED_BYTES. Only the last block end can be closer than that to the end
+ * of the stream; in this case there was no jump and the bytes after it are
+ * scanned again from the tail.
+ */
+int hash_context_final(HASH_CONTEXT *ctx)
+{
+    CHUNK_STATE *st = &ctx->st;
+    uint64 total = st->rs.offset, rest;
+
+    if(total == 0)
+        return -1;
+
+    if(ctx->length == STREAM_LENGTH_UNKNOWN && st->ended && st->last_end+profile->skipped_bytes >= total) {
+        rest = total-1 - st->last_end;
+
+        init_rolling_state(&st->rs, total);
+        st->rs.offset = st->last_end+1;
+        memcpy(st->rs.history, &ctx->tail[STREAM_TAIL-rest-profile->rolling_history], profile->rolling_history);
+        st->hashvalue = FNV64_INIT;
+
+        hash_window(st, ctx->fingerprint, &ctx->tail[STREAM_TAIL-rest], rest);
     }
 
     #ifndef network
-    	hashvalue = fnv64Bit(byte_buffer, last_block_index, bytes_read-1);
-    	add_hash_to_fingerprint(fingerprint, hashvalue);
+    	add_hash_to_fingerprint(ctx->fingerprint, st->hashvalue);
 	#endif
 
-    free(byte_buffer);
-    return 1;	
+    return 1;
 }
 
-int hashPacketBuffer(FINGERPRINT *fingerprint, const unsigned char *packet, const size_t length)
+/*
+ * Hashes a file into its fingerprint. Regular files are mapped and scanned
+ * in place; anything that cannot be mapped is read STREAM_BUFFER_SIZE bytes
+ * at a time, which gives the same fingerprint at constant memory.
+ */
+int hashFileToFingerprint(FINGERPRINT *fingerprint, FILE *handle)
 {
-    unsigned int i;
-    unsigned int last_block_index = 0;
-    uint64 rValue, hashvalue=0;
-    bool first = 1;
+    size_t  bytes_read;   //stores the number of characters read in the current window
+    unsigned char  *byte_buffer     = NULL;
+    HASH_CONTEXT ctx;
+    FILE_MAP map;
 
-    uchar window[ROLLING_WINDOW] = {0};
-    uint32 rhData[4]             = {0};
+    if(fingerprint->filesize == 0)
+        return -1;
 
+    if(map_file(&map, handle) == 0) {
+        //large files are split over several threads
+        if(mode->threads > 1 && map.size > SEGMENT_SIZE) {
+            hash_segments_to_fingerprint(fingerprint, map.data, map.size, mode->threads);
+            release_file(&map);
+            return 1;
+        }
 
-    for(i=0; i<length;i++)
-    {
-        rValue  = roll_hashx(packet[i], window, rhData);  
+        hash_context_init(&ctx, fingerprint, map.size);
+        hash_context_update(&ctx, map.data, map.size);
+        release_file(&map);
+    } else {
+        if((byte_buffer = (unsigned char*)malloc(sizeof(unsigned char)*STREAM_BUFFER_SIZE))==NULL)
+            return -1;
 
-        if (rValue % BLOCK_SIZE == BLOCK_SIZE-1) 
-        {
+        hash_context_init(&ctx, fingerprint, fingerprint->filesize);
 
-			#ifdef network
-        	if (first == 1){
-        		first=0;
-        		last_block_index = i+1;
-        		if(i+SKIPPED_BYTES < length)
-        		       i += SKIPPED_BYTES;
-        		continue;
-        	}
-			#endif
-        		hashvalue = fnv64Bit(packet, last_block_index, i); //,current_index, FNV1_64_INIT);
-        		add_hash_to_fingerprint(fingerprint, hashvalue);
+        fseeko(handle,0L, SEEK_SET);
+        posix_fadvise(fileno(handle), 0, 0, POSIX_FADV_SEQUENTIAL);
 
-        		last_block_index = i+1;
+        while((bytes_read = fread(byte_buffer,sizeof(unsigned char),STREAM_BUFFER_SIZE,handle)) > 0)
+            hash_context_update(&ctx, byte_buffer, bytes_read);
 
-            if(i+SKIPPED_BYTES < length)
-            	i += SKIPPED_BYTES;
-        }
+        free(byte_buffer);
     }
 
-#ifndef network
-    	hashvalue = fnv64Bit(packet, last_block_index, length-1);
-    	add_hash_to_fingerprint(fingerprint, hashvalue);
-#endif
+    return hash_context_final(&ctx);
+}
+
+
+int hashPacketBuffer(FINGERPRINT *fingerprint, const unsigned char *packet, const size_t length)
+{
+    HASH_CONTEXT ctx;
+
+    hash_context_init(&ctx, fingerprint, length);
+    hash_context_update(&ctx, packet, length);
+    hash_context_final(&ctx);
 
     return 1;
 }
 
-
 void print_md5value(unsigned char *md5_value)
 {
     int i;
@@ -213,43 +272,46 @@ unsigned char* retornar_string(unsigned char pBuffer[], int start, int end) {
    return string_saida;
  }
 
-int hashFile_features_extraction(unsigned int filesize, char *filename, FILE *handle, sqlite3 *db)
+/*
+ * Makes room for at least amount features; the content is kept
+ */
+static void reserve_features(FEATURE_BUFFER *buffer, size_t amount)
 {
-    unsigned long  bytes_read;   //stores the number of characters read from input file
-    unsigned int   i;
-    unsigned char  *byte_buffer     = NULL;
-    unsigned int last_block_index = 0;
-    uint64 rValue, hashvalue=0;
-    unsigned char *results = NULL;
-    int num_features = 0;	// counting the number of features
+    size_t capacity = MAX(buffer->capacity, 1024);
+    FEATURE *items;
 
+    if(amount <= buffer->capacity)
+        return;
 
-	int close_db=0;
-
-	if(db == NULL){
+    while(capacity < amount)
+        capacity *= 2;
 
-    		/* Open database */
-    		db = open_connection(DATA_BASE);
-		close_db=1;
-	}
+    if((items = (FEATURE *)realloc(buffer->items, capacity*sizeof(FEATURE))) == NULL) {
+        fprintf(stderr,"[*] Error in allocating feature buffer \n");
+        exit(-1);
+    }
+    buffer->items = items;
+    buffer->capacity = capacity;
+}
 
+/*
+ * Returns the ID of the object for filename, creating it or dropping the
+ * features stored for it before
+ */
+static int register_object(char *filename, sqlite3 *db)
+{
     char* name = basename(filename);
 
     /* Verifying if the registry already exists and if does getting ID */
     int id_obj = getting_id_from_objects_tb(name, db);
 
-    //printf("\nID: %d\n", id_obj);
-
     if (id_obj < 0) {
 
        	/* CREATING A NEW REGISTRY */
 	id_obj = inserting_new_obj_into_objects_tb(name, get_filename_ext(filename), get_file_size(filename), db);
 
-	if(id_obj < 0){
+	if(id_obj < 0)
 		printf("\nError! Object could not be inserted into database!\n");
-		return -1;
-	}
-	
     }
     else{
 	/* Removing existing features before inserting new ones
@@ -258,137 +320,143 @@ int hashFile_features_extraction(unsigned int filesize, char *filename, FILE *ha
 	remove_existing_features(db, id_obj);
     }
 
+    return id_obj;
+}
+
+/*
+ * Inserts the features of the buffer into the database in one transaction
+ */
+static void store_features(int id_obj, const FEATURE_BUFFER *features, sqlite3 *db, sqlite3_stmt *stmt)
+{
+    const FEATURE *feature;
+
+    execute_sql_statement("BEGIN TRANSACTION", db);
 
+    /* adding features to database */
+    for(feature = features->items; feature < features->items + features->amount; feature++)
+	inserting_feature_record_prepared_stmt(id_obj, feature->hash, feature->size, feature->offset, stmt);
 
-    struct features_obj *features = NULL;	
-    struct features_obj *last;// = (struct features_obj*) malloc(sizeof(features_obj));
+    execute_sql_statement("COMMIT", db);
+}
+
+/*
+ * Extracts the mrsh-v2 features (blocks) of a file into features.
+ * Returns their amount or -1 if the file could not be read.
+ */
+int extract_file_features(FILE *handle, FEATURE_BUFFER *features)
+{
+    uint64  bytes_read;   //stores the number of characters read from input file
+    uint64  i;
+    const unsigned char  *byte_buffer     = NULL;
+    uint64  last_block_index = 0;
+    FILE_MAP map;
+    uint64 hashvalue=0;
+    int num_features = 0;	// counting the number of features
+    FEATURE *feature;
 
-    /*we need this arrays for our extended rollhash function*/
-    uchar window[ROLLING_WINDOW] = {0};
-    uint32 rhData[4]             = {0};
+    ROLLING_STATE rs;
+    size_t ends[CHUNK_BATCH];
+    uint64 hashes[CHUNK_BATCH];
+    size_t amount, scanned, j;
+    uint64 pos, batch_start;
 
-    if((byte_buffer = (unsigned char*)malloc(sizeof(unsigned char)*filesize))==NULL)
+    if(load_file(&map, handle) != 0)
         return -1;
 
-    // bytes_read stores the number of characters we read from our file
-    fseek(handle,0L, SEEK_SET);	
-    if((bytes_read = fread(byte_buffer,sizeof(unsigned char),filesize,handle))==0)
-        return -1;
+    byte_buffer = map.data;
+    bytes_read = map.size;
+    init_rolling_state(&rs, bytes_read);
+
+    //a block is BLOCK_SIZE bytes long on average
+    features->amount = 0;
+    reserve_features(features, bytes_read/profile->block_size + 1);
 
+    #ifdef network
     short first = 1;
+    #endif
 
-    for(i=0; i<bytes_read; i++)
+    for(pos=0; pos<bytes_read; pos+=scanned)
     {
-        /*  
-         * rValue = djb2x(byte_buffer[i],window,i);  
-         */ 
-        rValue  = roll_hashx(byte_buffer[i], window, rhData);  
+        amount = find_chunk_ends(&rs, &byte_buffer[pos], bytes_read-pos, ends, CHUNK_BATCH, &scanned);
+        reserve_features(features, features->amount + amount);
 
-        if (rValue % BLOCK_SIZE == BLOCK_SIZE-1) // || chunk_index >= BLOCK_SIZE_MAX)
+        //the blocks of this batch are hashed together, starting with the open one
+        batch_start = last_block_index;
+        for(j=0; j<amount; j++)
+            ends[j] += pos - batch_start;
+        hash_chunks(&byte_buffer[batch_start], ends, amount, FNV64_INIT, hashes);
+
+        for(j=0; j<amount; j++)
         {
+        	i = batch_start + ends[j];
 
         	#ifdef network
         	if (first == 1){
         		first=0;
         		last_block_index = i+1;
-        		if(i+SKIPPED_BYTES < bytes_read)
-        		       i += SKIPPED_BYTES;
         		continue;
         	}
 			#endif
 
-        	hashvalue = fnv64Bit(byte_buffer, last_block_index, i); //,current_index, FNV1_64_INIT);
+        	hashvalue = hashes[j];
 
-		int size_fet = (i-last_block_index)+1;
+		uint32 size_fet = (i-last_block_index)+1;
 
-		//unsigned char *results = malloc(size*sizeof(unsigned char*));
-		results = malloc(sizeof(unsigned char*) * size_fet);
-		unsigned char c[3];
-		results[0]='\0';	// ensures the memory is an empty string
+		#ifdef DEBUG_FEATURES
+		printf("FEATURE ==> %llX\t - OFFSET: %llu\t - SIZE: %u\n", hashvalue, last_block_index, size_fet);
+		#endif
 
-		int z = last_block_index;
-		while( z <= i) {
-			sprintf(c, "%.2x ", (unsigned)byte_buffer[z++]);
-			//printf("%s", c);
-			strcat(results, c);
-			//printf("%x-", (unsigned)byte_buffer[z++]);
-		}
+		feature = &features->items[features->amount++];
+		feature->hash = hashvalue;
+		feature->offset = last_block_index;
+		feature->size = size_fet;
 
-		/*
-		// adding feature to database
-		
-		int id_fet = getting_feature_id((char*) hashvalue, db);
+            	last_block_index = i+1;
 
-	        printf("ID_FET: %d\n", id_fet);
+		num_features++;
+        }
+    }
 
-	        if (id_fet < 0) {
-	       		// CREATING A NEW FEATURE
-			printf("\n\nINSERTING\n\n");
-			id_fet = inserting_new_feature(id_obj, (char*) hashvalue, size_fet, (char*) last_block_index, db);
-			printf("\n\nID FEATURE CRIADA: %d\n\n", id_fet);
-	        }
-		else {
-			printf("\n\nUPDATING\n\n");
-			updating_feature(id_obj, id_fet, (char*) last_block_index, db);
-		}
+    release_file(&map);
 
-	       	//add_hash_to_fingerprint(fingerprint, hashvalue); //printf("%i %llu \n", i, hashvalue);
+    return num_features;
+}
 
-		*/
+/*
+ * Registers filename in the database and stores its features, or only
+ * registers it if features is NULL. Returns the amount of features stored
+ * or -1.
+ */
+int store_file_features(char *filename, const FEATURE_BUFFER *features, sqlite3 *db)
+{
+    int id_obj = register_object(filename, db);
 
-		if(features != NULL && features->size > 0){
-	
-			struct features_obj *temp;
-			temp = (struct features_obj*) malloc(sizeof(struct features_obj));
-			sprintf(temp->hash, "%X", (char*)hashvalue);
-			sprintf(temp->offset, "%X", (char*)last_block_index);
-			temp->size = size_fet;
-			temp->next = NULL;
-			last->next = temp;
-			last = temp;
-		}
-		else {
-
-			features = (struct features_obj*) malloc(sizeof(struct features_obj));
-
-			sprintf(features->hash, "%X", (char*)hashvalue);
-			sprintf(features->offset, "%X", (char*)last_block_index);
-			features->size = size_fet;
-			features->next = NULL;
-			last = features;
-		}
+    if(id_obj < 0 || features == NULL)
+	return -1;
 
-            	last_block_index = i+1;
+    sqlite3_stmt* stmt = prepared_insert_feature_statement(db);
 
-		num_features++;
+    store_features(id_obj, features, db, stmt);
 
-            	if(i+SKIPPED_BYTES < bytes_read)
-            		i += SKIPPED_BYTES;
+    finalize_prepared_stmt(stmt);
 
-	   	free(results);
-        }
-    }
+    return features->amount;
+}
 
-    #ifndef network
-    	hashvalue = fnv64Bit(byte_buffer, last_block_index, bytes_read-1);
-	//printf("FEATURE ==> %X\t - OFFSET: %d\t - SIZE: %d\n", hashvalue, last_block_index, (bytes_read-1 - last_block_index));
-	#endif
+int hashFile_features_extraction(char *filename, FILE *handle, sqlite3 *db)
+{
+    int num_features;
+	int close_db=0;
 
-    sqlite3_stmt* stmt = prepared_insert_feature_statement(db);
+	if(db == NULL){
 
-    struct features_obj *temp = features;
-    
-    while(features != NULL){
-	temp = features;
-	/* adding feature to database */
-	inserting_new_feature_prepared_stmt(id_obj, temp->hash, temp->size, temp->offset, db, stmt);
-	features = temp->next;
-	free(temp); 
-    }
+    		/* Open database */
+    		db = open_connection(DATA_BASE);
+		close_db=1;
+	}
 
-    free(features);
-    finalize_prepared_stmt(stmt);
-    free(byte_buffer);
+    num_features = extract_file_features(handle, &feature_buffer);
+    num_features = store_file_features(filename, (num_features < 0) ? NULL : &feature_buffer, db);
 
 	if(close_db > 0)
     		/* Close database */
@@ -400,14 +468,11 @@ int hashFile_features_extraction(unsigned int filesize, char *filename, FILE *ha
 
 
 
-int hashFile_features_extraction_checking(unsigned int filesize, char *filename, FILE *handle, sqlite3 *db)
+int hashFile_features_extraction_checking(char *filename, FILE *handle, sqlite3 *db)
 {
-    unsigned long  bytes_read;   //stores the number of characters read from input file
-    unsigned int   i;
-    unsigned char  *byte_buffer     = NULL;
-    unsigned int last_block_index = 0;
-    uint64 rValue, hashvalue=0;
-    unsigned char *results = NULL;
+    uint64  bytes_read;   //stores the number of characters read from input file
+    const unsigned char  *byte_buffer     = NULL;
+    FILE_MAP map;
     int num_features = 0;	// counting the number of features
 
 
@@ -423,75 +488,43 @@ int hashFile_features_extraction_checking(unsigned int filesize, char *filename,
     sqlite3_stmt* smtp = prepared_statement_select_num_features(db);
     int num_features_db = return_num_features_object_by_name(basename(filename), smtp);
 
-    /*we need this arrays for our extended rollhash function*/
-    uchar window[ROLLING_WINDOW] = {0};
-    uint32 rhData[4]             = {0};
+    ROLLING_STATE rs;
+    size_t ends[CHUNK_BATCH];
+    size_t amount, scanned;
+    uint64 pos;
 
-    if((byte_buffer = (unsigned char*)malloc(sizeof(unsigned char)*filesize))==NULL)
+    if(load_file(&map, handle) != 0) {
+        finalize_prepared_stmt(smtp);
+        if(close_db > 0)
+            close_connection(db);
         return -1;
+    }
 
-    // bytes_read stores the number of characters we read from our file
-    fseek(handle,0L, SEEK_SET);	
-    if((bytes_read = fread(byte_buffer,sizeof(unsigned char),filesize,handle))==0)
-        return -1;
+    byte_buffer = map.data;
+    bytes_read = map.size;
+    init_rolling_state(&rs, bytes_read);
 
+    #ifdef network
     short first = 1;
+    #endif
 
-    for(i=0; i<bytes_read; i++)
+    for(pos=0; pos<bytes_read; pos+=scanned)
     {
-        /*  
-         * rValue = djb2x(byte_buffer[i],window,i);  
-         */ 
-        rValue  = roll_hashx(byte_buffer[i], window, rhData);  
-
-        if (rValue % BLOCK_SIZE == BLOCK_SIZE-1) // || chunk_index >= BLOCK_SIZE_MAX)
-        {
-
-        	#ifdef network
-        	if (first == 1){
-        		first=0;
-        		last_block_index = i+1;
-        		if(i+SKIPPED_BYTES < bytes_read)
-        		       i += SKIPPED_BYTES;
-        		continue;
-        	}
-			#endif
-
-        	hashvalue = fnv64Bit(byte_buffer, last_block_index, i); //,current_index, FNV1_64_INIT);
-
-		int size_fet = (i-last_block_index)+1;
-
-		//unsigned char *results = malloc(size*sizeof(unsigned char*));
-		results = malloc(sizeof(unsigned char*) * size_fet);
-		unsigned char c[3];
-		results[0]='\0';	// ensures the memory is an empty string
-
-		int z = last_block_index;
-		while( z <= i) {
-			sprintf(c, "%.2x ", (unsigned)byte_buffer[z++]);
-			//printf("%s", c);
-			strcat(results, c);
-			//printf("%x-", (unsigned)byte_buffer[z++]);
-		}
-
-            	last_block_index = i+1;
-
-		num_features++;
-
-            	if(i+SKIPPED_BYTES < bytes_read)
-            		i += SKIPPED_BYTES;
+        amount = find_chunk_ends(&rs, &byte_buffer[pos], bytes_read-pos, ends, CHUNK_BATCH, &scanned);
 
-	   	free(results);
+        //only the number of features is compared, the blocks need not be hashed
+        #ifdef network
+        if (first == 1 && amount > 0){
+        	first=0;
+        	amount--;
         }
-    }
+		#endif
 
-    #ifndef network
-    	hashvalue = fnv64Bit(byte_buffer, last_block_index, bytes_read-1);
-	//printf("FEATURE ==> %X\t - OFFSET: %d\t - SIZE: %d\n", hashvalue, last_block_index, (bytes_read-1 - last_block_index));
-	#endif
+        num_features += amount;
+    }
 
     finalize_prepared_stmt(smtp);
-    free(byte_buffer);
+    release_file(&map);
 
     if( num_features_db != num_features)
         printf("\t\tDIFFERENCE!\n\t\t\tNUM FEATURES DB: %d / NUM EXTRACTED FEATURES: %d\n", num_features_db, num_features);
@@ -504,35 +537,74 @@ int hashFile_features_extraction_checking(unsigned int filesize, char *filename,
 }
 
 
-int hashFile_features_extraction_no_context(unsigned int filesize, char *filename, FILE *handle)
+/*
+ * Feature extraction with a window of SLIDING_WINDOW bytes at every offset.
+ * The windows are hashed with a polynomial rolling hash,
+ *      h = b[0]*P^(W-1) + b[1]*P^(W-2) + ... + b[W-1]   (mod 2^64),
+ * which is updated in O(1) per byte. The features are written to db in
+ * batches of FIXED_WINDOW_BATCH; without a database they are only counted.
+ */
+int hashFile_features_extraction_no_context(char *filename, FILE *handle, sqlite3 *db)
 {
-    unsigned long  bytes_read;   //stores the number of characters read from input file
-    unsigned int   i;
-    unsigned char  *byte_buffer     = NULL;
-    unsigned int last_block_index = 0;
-    uint64 hashvalue=0;
-
-    if((byte_buffer = (unsigned char*)malloc(sizeof(unsigned char)*filesize))==NULL)
+    uint64  bytes_read;   //stores the number of characters read from input file
+    uint64  i;
+    const unsigned char  *byte_buffer     = NULL;
+    FILE_MAP map;
+    uint64 hashvalue = 0, outgoing = 1;
+    FEATURE_BUFFER *features = &feature_buffer;
+    FEATURE *feature;
+    sqlite3_stmt *stmt = NULL;
+    int id_obj = -1, num_features = 0;
+
+    if(load_file(&map, handle) != 0)
         return -1;
 
-    // bytes_read stores the number of characters we read from our file
-    fseek(handle,0L, SEEK_SET);
+    byte_buffer = map.data;
+    bytes_read = map.size;
 
-    if((bytes_read = fread(byte_buffer,sizeof(unsigned char),filesize,handle))==0)
-        return -1;
+    if(db != NULL) {
+        if((id_obj = register_object(filename, db)) < 0) {
+            release_file(&map);
+            return -1;
+        }
+        stmt = prepared_insert_feature_statement(db);
+    }
+
+    //P^(W-1) removes the oldest byte from the window
+    for(i=1; i<SLIDING_WINDOW; i++)
+        outgoing *= WINDOW_PRIME;
+
+    for(i=0; i+1<SLIDING_WINDOW && i<bytes_read; i++)
+        hashvalue = hashvalue*WINDOW_PRIME + byte_buffer[i];
 
-    //printf("\nFile name: %s\n", filename);
+    features->amount = 0;
+    reserve_features(features, FIXED_WINDOW_BATCH);
 
     for(i=(SLIDING_WINDOW-1); i<bytes_read; i++)
     {
-	hashvalue = fnv64Bit(byte_buffer, last_block_index, i);
-	//printf("FEATURE ==> %16X\t - OFFSET: %d\t - SIZE: %d\n", hashvalue, last_block_index, (i - last_block_index)+1);
+	hashvalue = hashvalue*WINDOW_PRIME + byte_buffer[i];
 
-	last_block_index = last_block_index+1;
-    }
+	feature = &features->items[features->amount++];
+	feature->hash = hashvalue;
+	feature->offset = i-(SLIDING_WINDOW-1);
+	feature->size = SLIDING_WINDOW;
 
-    free(byte_buffer);
-    return 1;	
-}
+	#ifdef DEBUG_FEATURES
+	printf("FEATURE ==> %llX\t - OFFSET: %llu\t - SIZE: %u\n", feature->hash, feature->offset, feature->size);
+	#endif
 
+	hashvalue -= outgoing * byte_buffer[i-(SLIDING_WINDOW-1)];
 
+	if(features->amount == FIXED_WINDOW_BATCH || i+1 == bytes_read) {
+		if(stmt != NULL)
+			store_features(id_obj, features, db, stmt);
+		num_features += features->amount;
+		features->amount = 0;
+	}
+    }
+
+    if(stmt != NULL)
+        finalize_prepared_stmt(stmt);
+    release_file(&map);
+    return num_features;
+}
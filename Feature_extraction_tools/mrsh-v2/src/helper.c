@@ -43,3 +43,19 @@ FILE *getFileHandle(char *filename){
     return handle;
 }
 
+
+/*
+ * Reads the next file name of a list, without the line break.
+ * Returns 0 at the end of the list.
+ */
+int read_list_entry(FILE *arq, char *linha){
+	char *pos;
+
+	if( fgets (linha, SIZE_LINE, arq)==NULL )
+		return 0;
+
+	if ((pos=strchr(linha, '\n')) != NULL)
+		*pos = '\0';
+
+	return 1;
+}
@@ -0,0 +1,180 @@
+/*
+    File: list_extraction.c
+    Purpose: Extract the features of a list of files with several threads
+
+    The stages share a ring of job slots, which bounds the number of files in
+    flight. A slot runs through FREE -> QUEUED (reader) -> HASHING -> DONE
+    (hasher) -> FREE (writer). Slot k of the ring holds the files k, k+n,
+    k+2n, ... of the list, so the writer takes them in list order and the
+    database ends up the same as with a single thread. Only the writer uses
+    the SQLite connection.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../header/list_extraction.h"
+#include "../header/hashing.h"
+#include "../header/helper.h"
+#include "../header/filemap.h"
+
+// Files in flight per hashing thread
+#define SLOTS_PER_THREAD        4
+
+typedef enum {SLOT_FREE, SLOT_QUEUED, SLOT_HASHING, SLOT_DONE} SLOT_STATE;
+
+typedef struct {
+    char    path[SIZE_LINE];
+    FEATURE_BUFFER features;
+    int     num_features;
+    SLOT_STATE state;
+}LIST_SLOT;
+
+typedef struct {
+    FILE    *list;
+    LIST_SLOT *slots;
+    size_t  amount;
+
+    // Files of the list read so far and handed to a hasher so far
+    uint64  read, claimed;
+    bool    end_of_list;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+}LIST_PIPELINE;
+
+
+static void *read_list(void *arg)
+{
+    LIST_PIPELINE *pl = (LIST_PIPELINE *)arg;
+    LIST_SLOT *slot;
+    int has_line;
+
+    for(;;) {
+        pthread_mutex_lock(&pl->lock);
+        slot = &pl->slots[pl->read % pl->amount];
+        while(slot->state != SLOT_FREE)
+            pthread_cond_wait(&pl->changed, &pl->lock);
+        pthread_mutex_unlock(&pl->lock);
+
+        //a free slot belongs to the reader
+        has_line = read_list_entry(pl->list, slot->path);
+        if(has_line && mode->prefetch)
+            prefetch_file(slot->path);
+
+        pthread_mutex_lock(&pl->lock);
+        if(has_line) {
+            slot->state = SLOT_QUEUED;
+            pl->read++;
+        } else
+            pl->end_of_list = true;
+        pthread_cond_broadcast(&pl->changed);
+        pthread_mutex_unlock(&pl->lock);
+
+        if(!has_line)
+            return NULL;
+    }
+}
+
+static void *hash_list_files(void *arg)
+{
+    LIST_PIPELINE *pl = (LIST_PIPELINE *)arg;
+    LIST_SLOT *slot;
+    FILE *file;
+
+    pthread_mutex_lock(&pl->lock);
+    for(;;) {
+        while(pl->claimed == pl->read && !pl->end_of_list)
+            pthread_cond_wait(&pl->changed, &pl->lock);
+        if(pl->claimed == pl->read)
+            break;
+
+        slot = &pl->slots[pl->claimed++ % pl->amount];
+        slot->state = SLOT_HASHING;
+        pthread_mutex_unlock(&pl->lock);
+
+        file = getFileHandle(slot->path);
+        slot->num_features = extract_file_features(file, &slot->features);
+        fclose(file);
+
+        pthread_mutex_lock(&pl->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pl->changed);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+/*
+ * Extracts the features of all files of list into db with threads hashing
+ * threads. Returns the amount of files and adds their features to *num_features.
+ */
+int extract_list_parallel(FILE *list, sqlite3 *db, int threads, int *num_features)
+{
+    LIST_PIPELINE pl;
+    LIST_SLOT *slot;
+    pthread_t reader, *hashers;
+    int num_files = 0, num_obj_features, k;
+    size_t s;
+    bool done;
+
+    pl.list = list;
+    pl.amount = (size_t)threads * SLOTS_PER_THREAD;
+    pl.slots = (LIST_SLOT *)calloc(pl.amount, sizeof(LIST_SLOT));
+    hashers = (pthread_t *)malloc(threads*sizeof(pthread_t));
+    if(pl.slots == NULL || hashers == NULL) {
+        fprintf(stderr,"[*] Error in initializing list pipeline \n");
+        exit(-1);
+    }
+    pl.read = pl.claimed = 0;
+    pl.end_of_list = false;
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.changed, NULL);
+
+    if(pthread_create(&reader, NULL, read_list, &pl) != 0) {
+        fprintf(stderr,"[*] Error in starting list reader \n");
+        exit(-1);
+    }
+    for(k=0; k<threads; k++)
+        if(pthread_create(&hashers[k], NULL, hash_list_files, &pl) != 0) {
+            fprintf(stderr,"[*] Error in starting hashing thread \n");
+            exit(-1);
+        }
+
+    //the calling thread writes the files to the database in list order
+    for(;;) {
+        pthread_mutex_lock(&pl.lock);
+        slot = &pl.slots[num_files % pl.amount];
+        while(slot->state != SLOT_DONE && !(pl.end_of_list && (uint64)num_files == pl.read))
+            pthread_cond_wait(&pl.changed, &pl.lock);
+        done = (slot->state != SLOT_DONE);
+        pthread_mutex_unlock(&pl.lock);
+
+        if(done)
+            break;
+
+        printf("\n\tProcessing file: %s\n", slot->path);
+        num_obj_features = store_file_features(slot->path, (slot->num_features < 0) ? NULL : &slot->features, db);
+        printf("\t\tNum. features: %d", num_obj_features);
+        *num_features += num_obj_features;
+        num_files++;
+
+        pthread_mutex_lock(&pl.lock);
+        slot->state = SLOT_FREE;
+        pthread_cond_broadcast(&pl.changed);
+        pthread_mutex_unlock(&pl.lock);
+    }
+
+    pthread_join(reader, NULL);
+    for(k=0; k<threads; k++)
+        pthread_join(hashers[k], NULL);
+
+    for(s=0; s<pl.amount; s++)
+        free(pl.slots[s].features.items);
+    free(pl.slots);
+    free(hashers);
+    pthread_mutex_destroy(&pl.lock);
+    pthread_cond_destroy(&pl.changed);
+
+    return num_files;
+}
@@ -36,6 +36,12 @@
 #include "../header/main.h"
 #include "../header/helper.h";
 #include "../header/util.h";
+#include "../header/util_sql.h"
+#include "../header/filemap.h"
+#include "../header/list_extraction.h"
+#include "../header/digest_file.h"
+#include "../header/profile.h"
+#include "../header/output.h"
 #include <sqlite3.h> 
 
 
@@ -46,21 +52,22 @@ extern char *optarg;
 extern int optind;
 int num_global_features = 0; //counting the number of features
 
-#define SIZE_LINE 200
 
 static void show_help (void) {
     printf ("\nmrsh-v2  by Frank Breitinger\n"
     		"Copyright (C) 2013 \n"
     		"\n"
-    		"Usage: mrsh-v2 [-cgpfrhezys] [-t val] [-Ll LIST] [FILE/DIR/LIST]* \n"
+    		"Usage: mrsh-v2 [-bcgpfrhezysao] [-t val] [-S val] [-j threads] [-k val] [-n val] [-P profile] [-Ll LIST] [FILE/DIR/LIST]* \n"
             "OPTIONS: -c: Compares [FILE/DIR] against [FILE/DIR]. \n"
             "         -g: Generates and compares all files in [FILE/DIR]* against each other. \n"
             "         -L: Compare [LIST] against itself or [LIST] against [LIST]. \n"
     		"         -l: Compare [LIST] against [FILE/DIR]* . \n"
-            "         -p: Print similarity digest as hex of all [FILE/DIR]*. \n"
+            "         -p: Print similarity digest as hex of all [FILE/DIR]*, or of the digests of [LIST] given with -L. \n"
+            "         -b: With -p, write the digests as a binary digest file instead; -L and -l read both formats, binary ones only from regular files. \n"
             "         -f: Turns into file comparison mode which is better for getting exact similarity between files. \n"
             "         -r: Reads directories recursive. \n"
     		"         -t: All comparison yielding a score >= val are printed, i.e., 0 print all comparisons, \n"
+    		"         -S: A filter stops looking for a better match once it scored >= val (default 100); lower values are faster but may underestimate scores. \n"
 //    		"         -i: Very small inputs cannot be matched reliably only against large files. These comparisons are ignored. \n"
             "         -h: Print this help message \n"
 
@@ -68,8 +75,15 @@ static void show_help (void) {
 	    "\n         -e: Extract features from FILE and insert into database\n\t\t Ex.: mrsh-v2 -e FILE"
 	    "\n         -z: Extract features from a list of files and insert inyo database\n\t\t Ex.: mrsh-v2 -z list_of_files database_path"
             "\n         -y: Check the number of extracted features and database stored features for a list of files"
-            "\n         -s: Extract features from FILE using a sliding fixed-size window and insert into database\n\t\t Ex.: mrsh-v2 -s FILE\n"
+            "\n         -s: Extract features from FILE/DIR using a sliding fixed-size window and insert into database\n\t\t Ex.: mrsh-v2 -s FILE [database_path]; with -z the files of a list are processed"
+            "\n         -a: Read ahead the next file of the list while the current one is hashed (-z, -y)"
+            "\n         -j: Number of threads used to hash a large file (-p, -g, -c, -l), the files of a list (-z), to load digest lists (-L, -l) or to compare lists (-g, -L, -l, -c)"
+            "\n         -o: With -j, print the comparisons of -g, -L, -l and -c in the same order as a single thread"
+            "\n         -k: Keep the chunk hashes in the digests (-p) and only compare files sharing at least val chunks; faster for large sets, but pairs scoring only through false positives are not printed"
+            "\n         -n: Print only the val best matches (score >= -t) of each file, best first: among all others with -g and -L [LIST], in the first [LIST] or [FILE/DIR] for each file of the second one with -L, -l and -c"
+            "\n         -P: Use the parameter profile NAME; digests and features are only comparable within a profile\n"
 		);
+    print_profiles(stdout);
 }
 
 static void initalizeDefaultModes(){
@@ -88,6 +102,13 @@ static void initalizeDefaultModes(){
 	mode->extract_features_fw = false;
 	mode->extract_features_list=false;
 	mode->extract_features_list_check=false;
+	mode->prefetch=false;
+	mode->threads=1;
+	mode->saturation=100;
+	mode->ordered_output=false;
+	mode->min_shared_chunks=0;
+	mode->top_k=0;
+	mode->binary_digests=false;
 }
 
 int main(int argc, char **argv){
@@ -95,18 +116,24 @@ int main(int argc, char **argv){
 	int i;
 	initalizeDefaultModes();
 
+	//digests and match lines are collected in a buffer written when it is full and on exit
+	init_output(&standard_output, STDOUT_FILENO);
+	atexit(flush_standard_output);
+
 	char *listName = NULL;
 
-	while ((i=getopt(argc,argv,"cesyzgL:l:pfrt:h")) != -1) {
+	while ((i=getopt(argc,argv,"bcesyzagoj:k:n:P:S:L:l:pfrt:h")) != -1) {
 	    switch(i) {
 	    	case 'c':	mode->compare = true; break;
 	    	case 'g':	mode->gen_compare = true; break;
 	    	case 'L':	mode->compareLists = true; listName = optarg; break;
 	    	case 'l':	mode->path_list_compare = true; listName = optarg; break;
 	    	case 'p':	mode->print = true; break;
+	    	case 'b':	mode->binary_digests = true; break;
 	    	case 'f':	mode->file_comparison = true; break;
 	    	case 'r':	mode->recursive = true; break;
 	    	case 't': 	mode->threshold = atoi(optarg);  break;
+	    	case 'S': 	mode->saturation = atoi(optarg);  break;
 	    	case 'h':	mode->helpmessage = true; break;
 
 
@@ -114,6 +141,14 @@ int main(int argc, char **argv){
 		case 's':	mode->extract_features_fw = true; break;
 		case 'z':	mode->extract_features_list = true; break;
 		case 'y':	mode->extract_features_list_check = true; break;
+		case 'a':	mode->prefetch = true; break;
+		case 'o':	mode->ordered_output = true; break;
+		case 'j':	mode->threads = MAX(atoi(optarg), 1); break;
+		case 'k':	mode->min_shared_chunks = atoi(optarg); break;
+		case 'n':	mode->top_k = atoi(optarg); break;
+		case 'P':	if((profile = find_profile(optarg)) == NULL)
+						fatal_error("Unknown parameter profile, see -h for the available ones");
+					break;
 
 
 	    	default: 	mode->helpmessage = true;
@@ -128,12 +163,19 @@ int main(int argc, char **argv){
 	    	exit(0);
 	}
 
+	init_profile();
+
 	//read all arguments, create the fingerprint, and print it to stdout
 	if(mode->print || optind==1) {
-	  FINGERPRINT_LIST *fpl = init_empty_fingerprintList();
+	  FINGERPRINT_LIST *fpl = (listName != NULL) ? init_fingerprintList_for_ListFile(listName) : init_empty_fingerprintList();
 	  for (int j = optind; j < argc; j++)
 		  addPathToFingerprintList(fpl, argv[j]);
-	  print_fingerprintList(fpl);
+
+	  //a list with -L or -l is converted between the text and binary format
+	  if(mode->binary_digests)
+		  write_digest_file(fpl, stdout);
+	  else
+		  print_fingerprintList(fpl);
 	  fingerprintList_destroy(fpl);
 	  exit(1);
 	}
@@ -141,6 +183,12 @@ int main(int argc, char **argv){
 	//set a threshold
 	if(mode->threshold>100 || mode->threshold<0)
 		  fatal_error("Threshold value needs to be a number between 0 and 100");
+	if(mode->saturation>100 || mode->saturation<1)
+		  fatal_error("Saturation value needs to be a number between 1 and 100");
+	if(mode->top_k<0)
+		  fatal_error("Number of best matches needs to be a positive number");
+	if(mode->min_shared_chunks<0)
+		  fatal_error("Shared chunks value needs to be a positive number");
 
 	//compare all-against-all
 	if(mode->gen_compare) {
@@ -216,11 +264,13 @@ int main(int argc, char **argv){
 
 	
 	   //extracting features from the object using a fixed-size sliding window
-	   if(mode->extract_features_fw) {
+	   if(mode->extract_features_fw && !mode->extract_features_list) {
 
 		printf("FEATURE EXTRACTION OF: \n\t%s\n", argv[optind]);
 
-		featureExtraction(argv[optind]);
+		sqlite3 *db = open_connection((argc - optind) > 1 ? argv[optind+1] : DATA_BASE);
+		featureExtraction(argv[optind], db);
+		close_connection(db);
 
 	   }
 
@@ -341,6 +391,8 @@ void featureExtractionMRSH(char *filename){
 }
 
 
+
+
 /*
  * EXTRACT features from a list of files - MRSH-v2
  */
@@ -349,7 +401,8 @@ void featureExtractionMRSH_list(char *list, char *database){
 	FILE *arq;
 	int num_files=0;
 	int num_obj_features=0;
-	char linha[SIZE_LINE];
+	char linha[SIZE_LINE], next_linha[SIZE_LINE];
+	int has_line, has_next;
 	sqlite3 *db;
 
 	printf("\n**************** MRSH-v2 FEATURE EXTRACTION ****************\n\n");
@@ -368,22 +421,33 @@ void featureExtractionMRSH_list(char *list, char *database){
 
 	printf("[OK]\nStarting process:");
 
-	while (!feof(arq))
+	//several files are hashed at once; fixed-size windows are written while they are hashed
+	if(mode->threads > 1 && !mode->extract_features_fw) {
+		num_files = extract_list_parallel(arq, db, mode->threads, &num_global_features);
+		has_line = 0;
+	} else
+		has_line = read_list_entry(arq, linha);
+
+	while (has_line)
 	{
-		if( fgets (linha, SIZE_LINE, arq)!=NULL )
-		{
-			char *pos;
-			if ((pos=strchr(linha, '\n')) != NULL)
-				*pos = '\0';
-
-			printf("\n\tProcessing file: %s\n", linha);
-			FILE *file = getFileHandle(linha);
+		//the next file is looked up before the current one is hashed so the kernel can read it in the meantime
+		has_next = read_list_entry(arq, next_linha);
+		if(has_next && mode->prefetch)
+			prefetch_file(next_linha);
+
+		printf("\n\tProcessing file: %s\n", linha);
+		FILE *file = getFileHandle(linha);
+		if(mode->extract_features_fw)
+			num_obj_features = init_fingerprint_for_file_NO_BF_NO_CONTEXT(file, linha, db);
+		else
 			num_obj_features = init_fingerprint_for_file_NO_BF(file, linha, db);
-			printf("\t\tNum. features: %d", num_obj_features);
-			num_global_features+= num_obj_features;
-			num_obj_features=0;
-			num_files++;
-		}
+		printf("\t\tNum. features: %d", num_obj_features);
+		num_global_features+= num_obj_features;
+		num_obj_features=0;
+		num_files++;
+
+		strcpy(linha, next_linha);
+		has_line = has_next;
 	}
 
 	fclose(arq);
@@ -409,7 +473,8 @@ void featureExtractionMRSH_list_checking(char *list, char *database){
 	FILE *arq;
 	int num_files=0;
 	int num_obj_features=0;
-	char linha[SIZE_LINE];
+	char linha[SIZE_LINE], next_linha[SIZE_LINE];
+	int has_line, has_next;
 	sqlite3 *db;
 
 	printf("\n**************** MRSH-v2 FEATURE EXTRACTION CHECKING ****************\n\n");
@@ -428,22 +493,24 @@ void featureExtractionMRSH_list_checking(char *list, char *database){
 
 	printf("[OK]\nStarting process:");
 
-	while (!feof(arq))
+	has_line = read_list_entry(arq, linha);
+
+	while (has_line)
 	{
-		if( fgets (linha, SIZE_LINE, arq)!=NULL )
-		{
-			char *pos;
-			if ((pos=strchr(linha, '\n')) != NULL)
-				*pos = '\0';
-
-			printf("\n\tProcessing file: %s\n", linha);
-			FILE *file = getFileHandle(linha);
-			num_obj_features = init_fingerprint_for_file_checking(file, linha, db);
-			//printf("\t\tNum. features: %d", num_obj_features);
-			num_global_features+= num_obj_features;
-			num_obj_features=0;
-			num_files++;
-		}
+		has_next = read_list_entry(arq, next_linha);
+		if(has_next && mode->prefetch)
+			prefetch_file(next_linha);
+
+		printf("\n\tProcessing file: %s\n", linha);
+		FILE *file = getFileHandle(linha);
+		num_obj_features = init_fingerprint_for_file_checking(file, linha, db);
+		//printf("\t\tNum. features: %d", num_obj_features);
+		num_global_features+= num_obj_features;
+		num_obj_features=0;
+		num_files++;
+
+		strcpy(linha, next_linha);
+		has_line = has_next;
 	}
 
 	fclose(arq);
@@ -464,7 +531,7 @@ void featureExtractionMRSH_list_checking(char *list, char *database){
 /*
  * EXTRACT features from a file - sliding window
  */
-void featureExtraction(char *filename){
+void featureExtraction(char *filename, sqlite3 *db){
 	DIR *dir;
 	struct dirent *ent;
 	const int max_path_length = 1024;
@@ -483,14 +550,14 @@ void featureExtraction(char *filename){
 		  		//if we found a file, generate hash value and add it
 		  		if(is_file(ent->d_name)) {
 		  			FILE *file = getFileHandle(ent->d_name);
-		  			init_fingerprint_for_file_NO_BF_NO_CONTEXT(file, ent->d_name);
+		  			init_fingerprint_for_file_NO_BF_NO_CONTEXT(file, ent->d_name, db);
 		  		}
 
 		  		//when we found a dir and recursive mode is on, go deeper
 		  		else if(is_dir(ent->d_name) && mode->recursive) {
 		  			if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
 		  			    continue;
-		  			featureExtraction(ent->d_name);
+		  			featureExtraction(ent->d_name, db);
 		  		}
 		  	}
 		  	chdir(cur_dir);
@@ -500,7 +567,7 @@ void featureExtraction(char *filename){
 	//in case we we have only a file
 	else if(is_file(filename)) {
 		FILE *file = getFileHandle(filename);
-		init_fingerprint_for_file_NO_BF_NO_CONTEXT(file, filename);
+		init_fingerprint_for_file_NO_BF_NO_CONTEXT(file, filename, db);
 	}
 
 	return;
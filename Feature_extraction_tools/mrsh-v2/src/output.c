@@ -0,0 +1,187 @@
+/*
+    File: output.c
+    Purpose: Buffered output of digests and match lines (see output.h)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../header/output.h"
+
+
+OUTPUT_BUFFER standard_output = {NULL, 0, 0, STDOUT_FILENO, false};
+
+static pthread_mutex_t standard_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+
+void init_output(OUTPUT_BUFFER *out, int fd)
+{
+    out->text = NULL;
+    out->length = 0;
+    out->capacity = 0;
+    out->fd = fd;
+    out->interactive = (fd >= 0 && isatty(fd));
+}
+
+void free_output(OUTPUT_BUFFER *out)
+{
+    free(out->text);
+    out->text = NULL;
+    out->length = out->capacity = 0;
+}
+
+/*
+ * Writes the buffer to its descriptor. Text printed with stdio before is
+ * flushed first so both stay in order.
+ */
+void flush_output(OUTPUT_BUFFER *out)
+{
+    size_t done = 0;
+    ssize_t written;
+
+    if(out->fd < 0 || out->length == 0)
+        return;
+
+    fflush(stdout);
+    while(done < out->length) {
+        if((written = write(out->fd, &out->text[done], out->length-done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr,"[*] Error in writing output \n");
+            break;
+        }
+        done += written;
+    }
+    out->length = 0;
+}
+
+void flush_standard_output()
+{
+    flush_output(&standard_output);
+}
+
+/*
+ * Makes room for length more bytes: a buffer with a descriptor is flushed
+ * once it is full, any other one grows
+ */
+static char *reserve_output(OUTPUT_BUFFER *out, size_t length)
+{
+    if(out->length + length > out->capacity) {
+        if(out->fd >= 0 && out->capacity > 0)
+            flush_output(out);
+        if(out->length + length > out->capacity) {
+            out->capacity = MAX(MAX(out->length + length, 2*out->capacity), OUTPUT_BUFFER_SIZE);
+            if(!(out->text = (char *)realloc(out->text, out->capacity))) {
+                fprintf(stderr,"[*] Error in initializing output buffer \n");
+                exit(-1);
+            }
+        }
+    }
+    return &out->text[out->length];
+}
+
+
+void output_bytes(OUTPUT_BUFFER *out, const char *text, size_t length)
+{
+    if(length == 0)
+        return;
+    memcpy(reserve_output(out, length), text, length);
+    out->length += length;
+}
+
+void output_string(OUTPUT_BUFFER *out, const char *text)
+{
+    output_bytes(out, text, strlen(text));
+}
+
+/*
+ * Prints value with at least digits digits (at most 20), like "%.*lli"
+ */
+void output_decimal(OUTPUT_BUFFER *out, long long value, int digits)
+{
+    char reversed[24], *text;
+    unsigned long long magnitude = (value < 0) ? -(unsigned long long)value : (unsigned long long)value;
+    int amount = 0;
+
+    do {
+        reversed[amount++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude > 0);
+    while(amount < MIN(digits, 20))
+        reversed[amount++] = '0';
+    if(value < 0)
+        reversed[amount++] = '-';
+
+    text = reserve_output(out, amount);
+    out->length += amount;
+    while(amount > 0)
+        *text++ = reversed[--amount];
+}
+
+/*
+ * Prints each byte as 2 upper case hex digits, like "%02X"
+ */
+void output_hex(OUTPUT_BUFFER *out, const unsigned char *data, size_t bytes)
+{
+    char *text = reserve_output(out, 2*bytes);
+    size_t i;
+
+    for(i=0; i<bytes; i++) {
+        text[2*i]   = hex_digits[data[i] >> 4];
+        text[2*i+1] = hex_digits[data[i] & 0xF];
+    }
+    out->length += 2*bytes;
+}
+
+/*
+ * Prints value as 16 upper case hex digits, like "%016llX"
+ */
+void output_hex64(OUTPUT_BUFFER *out, uint64 value)
+{
+    char *text = reserve_output(out, 16);
+    int i;
+
+    for(i=15; i>=0; i--, value >>= 4)
+        text[i] = hex_digits[value & 0xF];
+    out->length += 16;
+}
+
+/*
+ * Prints a line of a comparison, like "%s | %s | %.3i \n"
+ */
+void output_match(OUTPUT_BUFFER *out, const char *name1, const char *name2, int score)
+{
+    output_string(out, name1);
+    output_bytes(out, " | ", 3);
+    output_string(out, name2);
+    output_bytes(out, " | ", 3);
+    output_decimal(out, score, 3);
+    output_bytes(out, " \n", 2);
+    end_output_record(out);
+}
+
+/*
+ * Ends a digest or a match line; a terminal gets it right away
+ */
+void end_output_record(OUTPUT_BUFFER *out)
+{
+    if(out->interactive)
+        flush_output(out);
+}
+
+
+/*
+ * Appends the text a thread formatted to standard_output, as one piece
+ */
+void output_shared(const char *text, size_t length)
+{
+    pthread_mutex_lock(&standard_output_lock);
+    output_bytes(&standard_output, text, length);
+    end_output_record(&standard_output);
+    pthread_mutex_unlock(&standard_output_lock);
+}
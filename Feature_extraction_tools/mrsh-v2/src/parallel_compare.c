@@ -0,0 +1,343 @@
+/*
+    File: parallel_compare.c
+    Purpose: Blocked comparison of fingerprint lists with several threads
+
+    The filters of each list are first packed into one aligned matrix, with a
+    copy of every FINGERPRINT pointing into it. The fingerprints of the first
+    list are split into bands of COMPARE_TILE and the pair space is cut into
+    tiles of one band of the first list against one band of the second, so
+    the filters of both sides of a tile stay in the cache while its pairs are
+    compared. When a list is compared against itself only the tiles of the
+    upper triangle are used. Tiles are numbered band by band and handed out in
+    that order, one at a time, to whichever thread is free; each thread
+    formats the lines of its tile into its own buffer.
+
+    Unordered, a thread passes the lines of a tile to the standard output in
+    one piece when the tile is done. Ordered, the tiles keep their lines and the calling thread
+    prints a band once all its tiles are done, row by row and tile by tile,
+    which is the order of the serial loops. Threads only take tiles up to
+    BANDS_AHEAD bands beyond the band being printed, which bounds the memory.
+    With a single thread the calling thread does the tiles itself.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../header/parallel_compare.h"
+#include "../header/profile.h"
+#include "../header/output.h"
+
+// Bands the threads may work ahead of the printed ones in ordered mode
+#define BANDS_AHEAD             4
+
+typedef struct {
+    OUTPUT_BUFFER lines;
+
+    // End of the lines of each row of the tile in lines
+    size_t  row_end[COMPARE_TILE];
+}TILE_OUTPUT;
+
+typedef struct {
+    PACKED_LIST *rows, *columns;
+    bool    triangular;
+
+    // Band of each tile and its first column, first tile and unfinished tiles of each band
+    uint32  bands, column_bands, tiles;
+    uint32  *tile_band, *tile_column;
+    uint32  *band_first, *band_left;
+
+    // Ordered: the lines of the tiles that are done but not printed yet
+    bool    ordered;
+    TILE_OUTPUT **outputs;
+
+    uint32  next_tile, printed_bands;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+}COMPARE_POOL;
+
+
+void pack_list(FINGERPRINT_LIST *fpl, PACKED_LIST *packed)
+{
+    size_t filters = 0, offset = 0;
+    FINGERPRINT *fp;
+    uint32 i;
+
+    packed->amount = 0;
+    for(fp=fpl->list; fp != NULL; fp=fp->next) {
+        packed->amount++;
+        filters += fp->amount_of_BF+1;
+    }
+
+    packed->fps       = (FINGERPRINT *)malloc((packed->amount+1)*sizeof(FINGERPRINT));
+    packed->blocks    = (short *)malloc((filters+1)*sizeof(short));
+    packed->bits_set  = (unsigned short *)malloc((filters+1)*sizeof(unsigned short));
+    packed->tail_bits = (unsigned short *)malloc((filters+1)*sizeof(unsigned short));
+    if(packed->fps == NULL || packed->blocks == NULL || packed->bits_set == NULL || packed->tail_bits == NULL ||
+            posix_memalign((void **)&packed->matrix, FILTER_ALIGNMENT, (filters+1)*profile->filter_size) != 0) {
+        fprintf(stderr,"[*] Error in initializing packed fingerprints \n");
+        exit(-1);
+    }
+
+    for(i=0, fp=fpl->list; fp != NULL; fp=fp->next, i++) {
+        size_t amount = fp->amount_of_BF+1;
+
+        packed->fps[i] = *fp;
+        packed->fps[i].next = (fp->next != NULL) ? &packed->fps[i+1] : NULL;
+        packed->fps[i].bf_array     = &packed->matrix[offset*profile->filter_size];
+        packed->fps[i].bf_blocks    = &packed->blocks[offset];
+        packed->fps[i].bf_bits_set  = &packed->bits_set[offset];
+        packed->fps[i].bf_tail_bits = &packed->tail_bits[offset];
+        packed->fps[i].bf_capacity  = amount;
+
+        memcpy(packed->fps[i].bf_array, fp->bf_array, amount*profile->filter_size);
+        memcpy(packed->fps[i].bf_blocks, fp->bf_blocks, amount*sizeof(short));
+        memcpy(packed->fps[i].bf_bits_set, fp->bf_bits_set, amount*sizeof(unsigned short));
+        memcpy(packed->fps[i].bf_tail_bits, fp->bf_tail_bits, amount*sizeof(unsigned short));
+        offset += amount;
+    }
+}
+
+void free_packed_list(PACKED_LIST *packed)
+{
+    free(packed->fps);
+    free(packed->matrix);
+    free(packed->blocks);
+    free(packed->bits_set);
+    free(packed->tail_bits);
+}
+
+
+static void compare_tile(COMPARE_POOL *pool, uint32 tile, TILE_OUTPUT *out)
+{
+    FINGERPRINT *rows = pool->rows->fps, *columns = pool->columns->fps;
+    uint32 row_start = pool->tile_band[tile]*COMPARE_TILE;
+    uint32 row_stop  = MIN(row_start+COMPARE_TILE, pool->rows->amount);
+    uint32 col_start = pool->tile_column[tile]*COMPARE_TILE;
+    uint32 col_stop  = MIN(col_start+COMPARE_TILE, pool->columns->amount);
+    uint32 i, j;
+    int score;
+
+    out->lines.length = 0;
+    for(i=row_start; i<row_stop; i++) {
+        for(j=pool->triangular ? MAX(col_start, i+1) : col_start; j<col_stop; j++) {
+            score = fingerprint_compare_bound(&rows[i], &columns[j], mode->threshold);
+            if(score >= mode->threshold)
+                output_match(&out->lines, rows[i].file_name, columns[j].file_name, score);
+        }
+        out->row_end[i-row_start] = out->lines.length;
+    }
+}
+
+static TILE_OUTPUT *new_tile_output()
+{
+    TILE_OUTPUT *out;
+
+    if(!(out = (TILE_OUTPUT *)calloc(1, sizeof(TILE_OUTPUT)))) {
+        fprintf(stderr,"[*] Error in initializing comparison output \n");
+        exit(-1);
+    }
+    init_output(&out->lines, -1);
+    return out;
+}
+
+static void *compare_tiles(void *arg)
+{
+    COMPARE_POOL *pool = (COMPARE_POOL *)arg;
+    TILE_OUTPUT unordered;
+    TILE_OUTPUT *out = &unordered;
+    uint32 tile;
+
+    init_output(&unordered.lines, -1);
+
+    for(;;) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->ordered && pool->next_tile < pool->tiles &&
+                pool->tile_band[pool->next_tile] >= pool->printed_bands + BANDS_AHEAD)
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        if(pool->next_tile == pool->tiles) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        tile = pool->next_tile++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(pool->ordered)
+            out = new_tile_output();
+        compare_tile(pool, tile, out);
+        if(!pool->ordered)
+            output_shared(out->lines.text, out->lines.length);
+
+        pthread_mutex_lock(&pool->lock);
+        if(pool->ordered)
+            pool->outputs[tile] = out;
+        if(--pool->band_left[pool->tile_band[tile]] == 0)
+            pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free_output(&unordered.lines);
+    return NULL;
+}
+
+/*
+ * Prints the lines of a finished band in the order of the serial loops
+ */
+static void print_band(COMPARE_POOL *pool, uint32 band)
+{
+    uint32 first = pool->band_first[band];
+    uint32 tiles = (band+1 < pool->bands) ? pool->band_first[band+1]-first : pool->tiles-first;
+    uint32 rows = MIN(COMPARE_TILE, pool->rows->amount - band*COMPARE_TILE);
+    uint32 r, k;
+    size_t start;
+
+    for(r=0; r<rows; r++) {
+        for(k=0; k<tiles; k++) {
+            TILE_OUTPUT *out = pool->outputs[first+k];
+            start = (r == 0) ? 0 : out->row_end[r-1];
+            output_bytes(&standard_output, &out->lines.text[start], out->row_end[r]-start);
+        }
+    }
+    end_output_record(&standard_output);
+
+    for(k=0; k<tiles; k++) {
+        free_output(&pool->outputs[first+k]->lines);
+        free(pool->outputs[first+k]);
+        pool->outputs[first+k] = NULL;
+    }
+}
+
+/*
+ * Runs the tiles with threads threads; the calling thread prints the bands
+ * in order or, with a single thread, does all the work itself.
+ * Returns -1 if no thread could be started.
+ */
+static int run_tiles(COMPARE_POOL *pool, int threads)
+{
+    pthread_t *workers;
+    uint32 b, t;
+    int k, started = 0;
+
+    if(threads <= 1) {
+        for(b=0, t=0; b<pool->bands; b++) {
+            for(; t<pool->tiles && pool->tile_band[t] == b; t++) {
+                pool->outputs[t] = new_tile_output();
+                compare_tile(pool, t, pool->outputs[t]);
+            }
+            print_band(pool, b);
+        }
+        return 1;
+    }
+
+    if(!(workers = (pthread_t *)malloc(threads*sizeof(pthread_t)))) {
+        fprintf(stderr,"[*] Error in initializing comparison threads \n");
+        exit(-1);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    for(k=0; k<threads; k++)
+        if(pthread_create(&workers[started], NULL, compare_tiles, pool) == 0)
+            started++;
+
+    if(started > 0) {
+        if(pool->ordered) {
+            for(b=0; b<pool->bands; b++) {
+                pthread_mutex_lock(&pool->lock);
+                while(pool->band_left[b] > 0)
+                    pthread_cond_wait(&pool->changed, &pool->lock);
+                pthread_mutex_unlock(&pool->lock);
+
+                print_band(pool, b);
+
+                pthread_mutex_lock(&pool->lock);
+                pool->printed_bands++;
+                pthread_cond_broadcast(&pool->changed);
+                pthread_mutex_unlock(&pool->lock);
+            }
+        }
+        for(k=0; k<started; k++)
+            pthread_join(workers[k], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->changed);
+    free(workers);
+
+    return (started > 0) ? 1 : -1;
+}
+
+/*
+ * Compares rows against columns, or rows against itself if columns is NULL
+ */
+static int compare_packed(PACKED_LIST *rows, PACKED_LIST *columns, int threads, bool ordered)
+{
+    COMPARE_POOL pool;
+    uint32 b, c, t;
+    int result;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.rows = rows;
+    pool.columns = (columns == NULL) ? rows : columns;
+    pool.triangular = (columns == NULL);
+    pool.ordered = ordered || threads <= 1;
+    pool.bands = (pool.rows->amount + COMPARE_TILE-1) / COMPARE_TILE;
+    pool.column_bands = (pool.columns->amount + COMPARE_TILE-1) / COMPARE_TILE;
+    pool.tiles = pool.triangular ? pool.bands*(pool.bands+1)/2 : pool.bands*pool.column_bands;
+
+    pool.tile_band   = (uint32 *)malloc((pool.tiles+1)*sizeof(uint32));
+    pool.tile_column = (uint32 *)malloc((pool.tiles+1)*sizeof(uint32));
+    pool.band_first  = (uint32 *)malloc((pool.bands+1)*sizeof(uint32));
+    pool.band_left   = (uint32 *)malloc((pool.bands+1)*sizeof(uint32));
+    pool.outputs     = (TILE_OUTPUT **)calloc(pool.tiles+1, sizeof(TILE_OUTPUT *));
+    if(pool.tile_band == NULL || pool.tile_column == NULL || pool.band_first == NULL ||
+            pool.band_left == NULL || pool.outputs == NULL) {
+        fprintf(stderr,"[*] Error in initializing comparison tiles \n");
+        exit(-1);
+    }
+
+    for(b=0, t=0; b<pool.bands; b++) {
+        pool.band_first[b] = t;
+        for(c=pool.triangular ? b : 0; c<pool.column_bands; c++, t++) {
+            pool.tile_band[t] = b;
+            pool.tile_column[t] = c;
+        }
+        pool.band_left[b] = t - pool.band_first[b];
+    }
+
+    result = run_tiles(&pool, threads);
+
+    free(pool.tile_band);
+    free(pool.tile_column);
+    free(pool.band_first);
+    free(pool.band_left);
+    free(pool.outputs);
+    return result;
+}
+
+
+int all_against_all_parallel(FINGERPRINT_LIST *fpl, int threads, bool ordered)
+{
+    PACKED_LIST packed;
+    int result;
+
+    pack_list(fpl, &packed);
+    result = compare_packed(&packed, NULL, threads, ordered);
+    free_packed_list(&packed);
+    return result;
+}
+
+int list_against_list_parallel(FINGERPRINT_LIST *fpl1, FINGERPRINT_LIST *fpl2, int threads, bool ordered)
+{
+    PACKED_LIST packed1, packed2;
+    int result;
+
+    pack_list(fpl1, &packed1);
+    pack_list(fpl2, &packed2);
+    result = compare_packed(&packed1, &packed2, threads, ordered);
+    free_packed_list(&packed1);
+    free_packed_list(&packed2);
+    return result;
+}
@@ -0,0 +1,248 @@
+/*
+    File: parallel_hashing.c
+    Purpose: Fingerprint one large file with several threads
+
+    The file is processed in rounds of one SEGMENT_SIZE segment per thread:
+
+    1. Every thread looks for block ends in its segment as if the bytes right
+       before the segment had been fed to the rolling hash without a jump.
+    2. The seams are fixed up in order: starting with the real state at the end
+       of the previous segment, the segment is scanned again until both scans
+       report the same block end, each with the 7 bytes before it fed without a
+       jump. From there on the rolling hash saw the same bytes in both scans and
+       the rest of the speculative result is kept.
+    3. Every thread computes the FNV hashes of the blocks ending in its segment.
+    4. The hashes are added to the fingerprint in file order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../header/parallel_hashing.h"
+#include "../header/chunker.h"
+#include "../header/util.h"
+#include "../header/profile.h"
+
+
+typedef struct {
+    const unsigned char *data;
+    uint64  filesize;
+
+    // Bytes of the file covered by this segment
+    uint64  start, end;
+
+    // Block ends (file offsets) found in the segment and the hashes of these blocks
+    size_t  *ends;
+    uint64  *hashes;
+    size_t  amount;
+
+    // First byte of the first block ending in this segment
+    uint64  block_start;
+
+    // Rolling hash state at the end of the segment after step 1
+    ROLLING_STATE rs;
+}SEGMENT;
+
+
+/*
+ * First byte fed to the rolling hash after a block end
+ */
+static inline uint64 next_fed_byte(uint64 block_end, uint64 filesize)
+{
+    return block_end + ((block_end+profile->skipped_bytes < filesize) ? profile->skipped_bytes : 0) + 1;
+}
+
+/*
+ * Most block ends a segment can have: one every SKIPPED_BYTES+1 bytes, and
+ * without jumps in the last SKIPPED_BYTES bytes of the file
+ */
+static inline size_t segment_capacity()
+{
+    return SEGMENT_SIZE/(profile->skipped_bytes+1) + profile->skipped_bytes + 2;
+}
+
+static void *scan_segment(void *arg)
+{
+    SEGMENT *seg = (SEGMENT *)arg;
+    size_t capacity = segment_capacity();
+    size_t amount, scanned, j;
+    uint64 pos = seg->start;
+
+    init_rolling_state(&seg->rs, seg->filesize);
+    seg->rs.offset = seg->start;
+    if(seg->start > 0)
+        memcpy(seg->rs.history, &seg->data[seg->start-profile->rolling_history], profile->rolling_history);
+
+    seg->amount = 0;
+    while(pos < seg->end) {
+        amount = find_chunk_ends(&seg->rs, &seg->data[pos], seg->end-pos, &seg->ends[seg->amount], capacity-seg->amount, &scanned);
+        for(j=0; j<amount; j++)
+            seg->ends[seg->amount++] += pos;
+        pos += scanned;
+    }
+    return NULL;
+}
+
+/*
+ * Replaces the speculative block ends of a segment with the real ones.
+ * rs is the real state at the start of the segment and is left at its end,
+ * landing is the first byte fed after the last real block end.
+ */
+static void stitch_segment(SEGMENT *seg, ROLLING_STATE *rs, uint64 *landing, size_t *scratch)
+{
+    size_t found = 0, j = 0, end, scanned;
+    uint64 pos = seg->start, b;
+    bool contiguous, converged = false;
+
+    //the first segment of the file started with the real state
+    if(seg->start == 0) {
+        *rs = seg->rs;
+    } else {
+        while(pos < seg->end) {
+            if(find_chunk_ends(rs, &seg->data[pos], seg->end-pos, &end, 1, &scanned) == 0) {
+                pos += scanned;
+                continue;
+            }
+            b = pos + end;
+            pos += scanned;
+
+            scratch[found++] = b;
+            contiguous = (b - *landing >= profile->rolling_history-1);
+            *landing = next_fed_byte(b, seg->filesize);
+
+            while(j < seg->amount && seg->ends[j] < b)
+                j++;
+
+            if(contiguous && j < seg->amount && seg->ends[j] == b &&
+                    (j == 0 || b - next_fed_byte(seg->ends[j-1], seg->filesize) >= profile->rolling_history-1)) {
+                memmove(&seg->ends[found], &seg->ends[j+1], (seg->amount-j-1)*sizeof(size_t));
+                seg->amount = found + seg->amount-j-1;
+                *rs = seg->rs;
+                converged = true;
+                break;
+            }
+        }
+
+        memcpy(seg->ends, scratch, found*sizeof(size_t));
+        if(!converged)
+            seg->amount = found;
+    }
+
+    if(seg->amount > 0)
+        *landing = next_fed_byte(seg->ends[seg->amount-1], seg->filesize);
+}
+
+static void *hash_segment(void *arg)
+{
+    SEGMENT *seg = (SEGMENT *)arg;
+    size_t j;
+
+    for(j=0; j<seg->amount; j++)
+        seg->ends[j] -= seg->block_start;
+
+    hash_chunks(&seg->data[seg->block_start], seg->ends, seg->amount, FNV64_INIT, seg->hashes);
+    return NULL;
+}
+
+/*
+ * Runs work on the first amount segments, one thread each
+ */
+static void run_workers(void *(*work)(void *), SEGMENT *segments, pthread_t *workers, int amount)
+{
+    bool *started = (bool *)calloc(amount, sizeof(bool));
+    int k;
+
+    for(k=1; k<amount; k++)
+        started[k] = (pthread_create(&workers[k], NULL, work, &segments[k]) == 0);
+
+    work(&segments[0]);
+
+    for(k=1; k<amount; k++) {
+        if(started[k])
+            pthread_join(workers[k], NULL);
+        else
+            work(&segments[k]);
+    }
+    free(started);
+}
+
+
+int hash_segments_to_fingerprint(FINGERPRINT *fingerprint, const unsigned char *data, uint64 size, int threads)
+{
+    size_t capacity = segment_capacity();
+    SEGMENT *segments;
+    pthread_t *workers;
+    size_t *scratch;
+    ROLLING_STATE rs;
+    uint64 round_start, landing = 0, block_start = 0;
+    #ifdef network
+    bool first = 1;
+    #endif
+    size_t j;
+    int k, used;
+
+    segments = (SEGMENT *)calloc(threads, sizeof(SEGMENT));
+    workers  = (pthread_t *)malloc(threads*sizeof(pthread_t));
+    scratch  = (size_t *)malloc(capacity*sizeof(size_t));
+    if(segments == NULL || workers == NULL || scratch == NULL) {
+        fprintf(stderr,"[*] Error in initializing segments \n");
+        exit(-1);
+    }
+
+    for(k=0; k<threads; k++) {
+        segments[k].data = data;
+        segments[k].filesize = size;
+        segments[k].ends = (size_t *)malloc(capacity*sizeof(size_t));
+        segments[k].hashes = (uint64 *)malloc(capacity*sizeof(uint64));
+        if(segments[k].ends == NULL || segments[k].hashes == NULL) {
+            fprintf(stderr,"[*] Error in initializing segments \n");
+            exit(-1);
+        }
+    }
+
+    init_rolling_state(&rs, size);
+
+    for(round_start=0; round_start<size; round_start+=(uint64)used*SEGMENT_SIZE) {
+        for(used=0; used<threads && round_start+(uint64)used*SEGMENT_SIZE < size; used++) {
+            segments[used].start = round_start + (uint64)used*SEGMENT_SIZE;
+            segments[used].end = MIN(segments[used].start+SEGMENT_SIZE, size);
+        }
+
+        run_workers(scan_segment, segments, workers, used);
+
+        for(k=0; k<used; k++) {
+            stitch_segment(&segments[k], &rs, &landing, scratch);
+            segments[k].block_start = block_start;
+            if(segments[k].amount > 0)
+                block_start = segments[k].ends[segments[k].amount-1]+1;
+        }
+
+        run_workers(hash_segment, segments, workers, used);
+
+        for(k=0; k<used; k++) {
+            for(j=0; j<segments[k].amount; j++) {
+                #ifdef network
+                if (first == 1) {
+                    first=0;
+                    continue;
+                }
+                #endif
+                add_hash_to_fingerprint(fingerprint, segments[k].hashes[j]);
+            }
+        }
+    }
+
+    #ifndef network
+    	add_hash_to_fingerprint(fingerprint, fnv64Bit_update(FNV64_INIT, &data[block_start], size-block_start));
+	#endif
+
+    for(k=0; k<threads; k++) {
+        free(segments[k].ends);
+        free(segments[k].hashes);
+    }
+    free(segments);
+    free(workers);
+    free(scratch);
+    return 1;
+}
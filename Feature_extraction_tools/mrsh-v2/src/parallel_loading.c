@@ -0,0 +1,141 @@
+/*
+    File: parallel_loading.c
+    Purpose: Read a text digest list with several threads (see parallel_loading.h)
+
+    Every thread parses the lines of its range into a chain of fingerprints
+    of its own. A range starts right after a newline, so no line is split;
+    the chains are linked in range order once all threads are done.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../header/parallel_loading.h"
+#include "../header/filemap.h"
+
+
+typedef struct {
+    // Whole lines of the list parsed by this thread
+    const char  *start, *end;
+
+    // Fingerprints of these lines in file order
+    FINGERPRINT *first, *last;
+    unsigned int amount;
+}LOAD_RANGE;
+
+
+static void *parse_range(void *arg)
+{
+    LOAD_RANGE *range = (LOAD_RANGE *)arg;
+    const char *next, *newline;
+    char *line = NULL;
+    size_t length, capacity = 0;
+    FINGERPRINT *fp;
+
+    for(next=range->start; next<range->end; next+=length) {
+        newline = (const char *)memchr(next, '\n', range->end-next);
+        length = (size_t)(((newline != NULL) ? newline+1 : range->end) - next);
+
+        //the line is parsed in place, like the buffer of getline()
+        if(length+1 > capacity) {
+            capacity = 2*(length+1);
+            if(!(line = (char *)realloc(line, capacity))) {
+                fprintf(stderr,"[*] Error in initializing line buffer \n");
+                exit(-1);
+            }
+        }
+        memcpy(line, next, length);
+        line[length] = '\0';
+
+        if((fp = parse_digest_line(line)) == NULL)
+            continue;
+        if(range->first == NULL)
+            range->first = fp;
+        else
+            range->last->next = fp;
+        range->last = fp;
+        range->amount++;
+    }
+
+    free(line);
+    return NULL;
+}
+
+/*
+ * First byte of the line that contains or starts at offset
+ */
+static const char *line_start(const char *data, uint64 size, uint64 offset)
+{
+    const char *newline;
+
+    if(offset == 0 || data[offset-1] == '\n')
+        return &data[offset];
+    newline = (const char *)memchr(&data[offset], '\n', size-offset);
+    return (newline != NULL) ? newline+1 : &data[size];
+}
+
+
+/*
+ * Returns -1 if the list cannot be loaded into memory, the caller should
+ * then read it with read_fingerprint_file(). Closes handle otherwise.
+ */
+int read_fingerprint_file_parallel(FINGERPRINT_LIST *fpl, FILE *handle, int threads)
+{
+    FILE_MAP list;
+    LOAD_RANGE *ranges;
+    pthread_t *workers;
+    bool *started;
+    const char *data;
+    int k;
+
+    if(load_file(&list, handle) != 0)
+        return -1;
+    fclose(handle);
+
+    //small lists are not worth a thread per range
+    threads = (int)MIN((uint64)threads, list.size/LOAD_RANGE_SIZE + 1);
+
+    ranges  = (LOAD_RANGE *)calloc(threads, sizeof(LOAD_RANGE));
+    workers = (pthread_t *)malloc(threads*sizeof(pthread_t));
+    started = (bool *)calloc(threads, sizeof(bool));
+    if(ranges == NULL || workers == NULL || started == NULL) {
+        fprintf(stderr,"[*] Error in initializing load ranges \n");
+        exit(-1);
+    }
+
+    data = (const char *)list.data;
+    for(k=0; k<threads; k++) {
+        ranges[k].start = line_start(data, list.size, list.size*k/threads);
+        ranges[k].end = line_start(data, list.size, list.size*(k+1)/threads);
+    }
+
+    for(k=1; k<threads; k++)
+        started[k] = (pthread_create(&workers[k], NULL, parse_range, &ranges[k]) == 0);
+
+    parse_range(&ranges[0]);
+
+    for(k=1; k<threads; k++) {
+        if(started[k])
+            pthread_join(workers[k], NULL);
+        else
+            parse_range(&ranges[k]);
+    }
+
+    for(k=0; k<threads; k++) {
+        if(ranges[k].first == NULL)
+            continue;
+        if(fpl->list == NULL)
+            fpl->list = ranges[k].first;
+        else
+            fpl->last_element->next = ranges[k].first;
+        fpl->last_element = ranges[k].last;
+        fpl->size += ranges[k].amount;
+    }
+
+    release_file(&list);
+    free(ranges);
+    free(workers);
+    free(started);
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+    File: profile_kernels.c
+    Purpose: The kernels that depend on the mrsh-v2 parameters.
+
+    This file is not compiled on its own. profiles.c includes it once per
+    parameter profile, with ROLLING_WINDOW, BLOCK_SIZE, SKIPPED_BYTES,
+    FILTERSIZE, SUBHASHES, SHIFTOPS, MASK, MAXBLOCKS and PROBABILITY defined
+    to the values of the profile and PROFILE_ID to its name, so each profile
+    gets its own constant-folded copy of every function. KERNEL(name) gives
+    the name of a function for the current profile.
+
+    roll_hashx() only depends on the bytes it was fed last: rhData[1] is the
+    sum and rhData[2] the weighted sum of the last ROLLING_WINDOW bytes and
+    rhData[3] shifts every byte out after 7 steps. The value at a position can
+    therefore be computed from the bytes right before it, independently of all
+    other positions, which lets us test many positions at once.
+*/
+
+#if ROLLING_HISTORY > ROLLING_HISTORY_MAX || SKIPPED_BYTES > SKIPPED_BYTES_MAX || FILTERSIZE > FILTERSIZE_MAX
+#error "profile parameters exceed the space reserved in config.h"
+#endif
+#if FILTERSIZE % POPCOUNT_CHUNK != 0 || FILTERSIZE % FILTER_ALIGNMENT != 0
+#error "FILTERSIZE has to be a multiple of POPCOUNT_CHUNK and FILTER_ALIGNMENT"
+#endif
+#if MASK != FILTERSIZE*8-1 || SHIFTOPS*SUBHASHES > 64
+#error "a subhash has to address a bit of the Bloom filter"
+#endif
+
+/*
+ * A block ends where value % BLOCK_SIZE == BLOCK_SIZE-1. The low 5 bits of the
+ * value only depend on the weighted byte sum of the window plus the newest
+ * byte (rhData[3] shifts the older bytes by 5 and more), so they can be
+ * computed in 8-bit lanes. This filter lets through 1 of 32 positions when
+ * BLOCK_SIZE is a multiple of 32; each candidate is then checked exactly.
+ */
+#define LOWEST_BIT(x)           ((x) & -(x))
+#define CANDIDATE_MASK          ((LOWEST_BIT(BLOCK_SIZE) < 32 ? LOWEST_BIT(BLOCK_SIZE) : 32) - 1)
+#define CANDIDATE_TARGET        ((BLOCK_SIZE-1) & CANDIDATE_MASK)
+
+#define IS_BLOCK_END(value)     ((value) % BLOCK_SIZE == BLOCK_SIZE-1)
+
+//where common_bits_cut() checks if a pair can still reach the threshold
+#define CUT_POINT               (FILTERSIZE*3/4/POPCOUNT_CHUNK*POPCOUNT_CHUNK)
+
+
+/*
+ * Value of roll_hashx() after it was fed the ROLLING_HISTORY bytes ending at newest
+ */
+static inline uint32 KERNEL(rolling_hash_value)(const uchar *newest)
+{
+    uint32 h1 = 0, h2 = 0, h3 = 0;
+    int k;
+
+    for(k=0; k<ROLLING_WINDOW; k++) {
+        h1 += newest[-k];
+        h2 += (ROLLING_WINDOW-k) * newest[-k];
+    }
+    for(k=0; k<7; k++)
+        h3 ^= (uint32)newest[-k] << (5*k);
+
+    return h1 + h2 + h3;
+}
+
+/*
+ * Low bits of rolling_hash_value() as used by the candidate filter
+ */
+static inline uchar KERNEL(candidate_bits)(const uchar *newest)
+{
+    uchar sum = newest[0];
+    int k;
+
+    for(k=0; k<ROLLING_WINDOW; k++)
+        sum += (ROLLING_WINDOW+1-k) * newest[-k];
+
+    return sum & CANDIDATE_MASK;
+}
+
+/*
+ * Returns the first position in [p, end) that passes the candidate filter,
+ * or end. The ROLLING_WINDOW-1 bytes before p must be valid.
+ */
+static size_t KERNEL(next_candidate)(const uchar *buffer, size_t p, size_t end)
+{
+#if defined(__SSE2__)
+    const __m128i mask   = _mm_set1_epi8(CANDIDATE_MASK);
+    const __m128i target = _mm_set1_epi8(CANDIDATE_TARGET);
+
+    /*
+     * sum = (W+1)*b[0] + W*b[-1] + ... + 2*b[-(W-1)] + b[0] is built from the
+     * prefix sums P_m = b[0] + ... + b[-(m-1)]: sum = P_1 + ... + P_W + P_W + b[0]
+     */
+    for(; p+16 <= end; p+=16) {
+        __m128i newest = _mm_loadu_si128((const __m128i *)&buffer[p]);
+        __m128i prefix = newest;
+        __m128i sum    = _mm_add_epi8(newest, newest);
+        int k, hits;
+
+        for(k=1; k<ROLLING_WINDOW; k++) {
+            prefix = _mm_add_epi8(prefix, _mm_loadu_si128((const __m128i *)&buffer[p-k]));
+            sum    = _mm_add_epi8(sum, prefix);
+        }
+        sum = _mm_add_epi8(sum, prefix);
+
+        hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(sum, mask), target));
+        if(hits)
+            return p + __builtin_ctz(hits);
+    }
+#endif
+
+    for(; p<end; p++)
+        if(KERNEL(candidate_bits)(&buffer[p]) == CANDIDATE_TARGET)
+            return p;
+
+    return end;
+}
+
+/*
+ * Scans buffer for block ends with the same semantics as the roll_hashx() loop:
+ * after each block end the next SKIPPED_BYTES bytes are not fed to the rolling
+ * hash unless the jump would leave the input. Writes the buffer positions of
+ * the last byte of each block to ends and returns their amount.
+ *
+ * At most max_ends ends are returned; *scanned tells how many bytes of the
+ * buffer were consumed, the rest has to be passed in again.
+ */
+static size_t KERNEL(find_chunk_ends)(ROLLING_STATE *rs, const uchar *buffer, size_t length, size_t *ends, size_t max_ends, size_t *scanned)
+{
+    uchar *history = rs->history;
+    size_t n = 0, p, run_start;
+    uint64 skip, next;
+
+    //the whole buffer lies within skipped bytes
+    if(rs->resume >= length) {
+        rs->resume -= length;
+        rs->offset += length;
+        *scanned = length;
+        return 0;
+    }
+
+    p = run_start = rs->resume;
+    rs->resume = 0;
+    *scanned = length;
+
+    while(p < length) {
+        //the first bytes after a jump or at the start of the buffer see bytes that were fed before
+        if(p - run_start < ROLLING_HISTORY-1) {
+            memmove(history, history+1, ROLLING_HISTORY-1);
+            history[ROLLING_HISTORY-1] = buffer[p];
+
+            if(!IS_BLOCK_END(KERNEL(rolling_hash_value)(&history[ROLLING_HISTORY-1]))) {
+                p++;
+                continue;
+            }
+        } else {
+            if((p = KERNEL(next_candidate)(buffer, p, length)) == length)
+                break;
+
+            if(!IS_BLOCK_END(KERNEL(rolling_hash_value)(&buffer[p]))) {
+                p++;
+                continue;
+            }
+            memcpy(history, &buffer[p-(ROLLING_HISTORY-1)], ROLLING_HISTORY);
+        }
+
+        ends[n++] = p;
+
+        skip = (rs->offset+p+SKIPPED_BYTES < rs->size) ? SKIPPED_BYTES : 0;
+        next = p + skip + 1;
+
+        if(n == max_ends) {
+            rs->resume = skip;
+            *scanned = p+1;
+            break;
+        }
+        if(next > length) {
+            rs->resume = next - length;
+            break;
+        }
+        p = run_start = next;
+    }
+
+    //remember the last bytes fed if the scan ran to the end of the buffer
+    if(p == length && length - run_start >= ROLLING_HISTORY)
+        memcpy(history, &buffer[length-ROLLING_HISTORY], ROLLING_HISTORY);
+
+    rs->offset += *scanned;
+    return n;
+}
+
+
+/*
+ * adds a hash value (eg. FNV) to Bloom filter bf of fp
+ */
+static void KERNEL(add_hash_to_bloomfilter)(FINGERPRINT *fp, unsigned int bf, uint64 hash_value){
+	unsigned char *array = &fp->bf_array[(size_t)bf*FILTERSIZE];
+	unsigned short masked_bits;
+	short byte_pos,bit_pos, one_counter=0;
+
+
+	//add the hash value to the bloom filter
+	for(int j=0;j<SUBHASHES;j++) {
+
+          masked_bits = ( hash_value >> (SHIFTOPS * j)) & MASK;
+          byte_pos = masked_bits >> 3;
+          bit_pos = masked_bits & 0x7;
+
+          if(((array[byte_pos]>>bit_pos) & 1)) {
+        	  one_counter++;
+          } else {
+        	  fp->bf_bits_set[bf]++;
+        	  if(byte_pos >= CUT_POINT)
+        		  fp->bf_tail_bits[bf]++;
+          }
+          array[byte_pos] |= (1<<(bit_pos));
+	}
+	//if all bits were set to one, there is nothing new and we ignore this block
+	//in worst case it is an attack
+	if(one_counter != SUBHASHES)
+		fp->bf_blocks[bf]++;
+}
+
+
+/*
+ * Hamming weight of a filter and of the AND of two filters. BIT_KERNELS
+ * stamps out one family per instruction set from its popcount_block_ISA()
+ * helper in profiles.c; KERNEL(init) stores the best one the CPU
+ * supports in the profile.
+ *
+ * common_bits_cut() gives up when the bits of query that are left cannot
+ * lift the result to cutoff. The result is exact if it is at least cutoff and
+ * below cutoff otherwise. Unrelated filters share about e_min bits and the
+ * threshold C lies 30% of the way from e_min to e_max, so that bound can only
+ * rule out a pair after about 70% of the filter: it is checked before the
+ * first byte and at CUT_POINT; the weights of query are kept in its filter.
+ */
+#define BIT_KERNELS(isa, attributes) \
+attributes static unsigned short KERNEL(common_bits_##isa)(const unsigned char bit_array_one[], const unsigned char bit_array_two[]) { \
+    return popcount_block_##isa(bit_array_one, bit_array_two, FILTERSIZE); \
+} \
+attributes static unsigned short KERNEL(count_bits_##isa)(const unsigned char filter[]) { \
+    return popcount_block_##isa(filter, filter, FILTERSIZE); \
+} \
+attributes static unsigned short KERNEL(filter_weights_##isa)(const unsigned char filter[], unsigned short *tail_bits) { \
+    *tail_bits = popcount_block_##isa(&filter[CUT_POINT], &filter[CUT_POINT], FILTERSIZE-CUT_POINT); \
+    return popcount_block_##isa(filter, filter, CUT_POINT) + *tail_bits; \
+} \
+attributes static unsigned short KERNEL(common_bits_cut_##isa)(const unsigned char query[], const unsigned char target[], unsigned short query_bits, unsigned short query_tail_bits, int cutoff) { \
+    unsigned short counted_bits; \
+    if(query_bits < cutoff) \
+        return 0; \
+    counted_bits = popcount_block_##isa(query, target, CUT_POINT); \
+    if(counted_bits + query_tail_bits < cutoff) \
+        return counted_bits; \
+    return counted_bits + popcount_block_##isa(&query[CUT_POINT], &target[CUT_POINT], FILTERSIZE-CUT_POINT); \
+}
+
+BIT_KERNELS(portable, )
+#if defined(X86_KERNELS)
+BIT_KERNELS(popcnt, __attribute__((target("popcnt"))))
+BIT_KERNELS(avx2,   __attribute__((target("avx2"))))
+BIT_KERNELS(avx512, __attribute__((target("avx512f,avx512vpopcntdq"))))
+#endif
+
+
+static double KERNEL(compute_e_min)(int blocks_in_bf1, int blocks_in_bf2){
+	int b1 = blocks_in_bf1;
+	int b2 = blocks_in_bf2;
+
+	double tmp1 = pow(PROBABILITY, SUBHASHES*b1);
+	double tmp2 = pow(PROBABILITY, SUBHASHES*b2);
+	double tmp3 = pow(PROBABILITY, SUBHASHES*(b1+b2));
+
+	return BLOOMFILTERBITSIZE*(1 - tmp1 - tmp2 + tmp3);
+}
+
+/*
+ * e_min as used for scoring, truncated to an integer. It only depends on the
+ * block counts of the two filters and is looked up in a table filled by
+ * KERNEL(init); counts outside [0, MAXBLOCKS], which only come from digests
+ * of other profiles, are computed.
+ */
+static unsigned short KERNEL(e_min_table)[(MAXBLOCKS+1)*(MAXBLOCKS+1)];
+
+static inline int KERNEL(e_min)(int blocks_in_bf1, int blocks_in_bf2){
+	if((unsigned int)blocks_in_bf1 <= MAXBLOCKS && (unsigned int)blocks_in_bf2 <= MAXBLOCKS)
+		return KERNEL(e_min_table)[blocks_in_bf1*(MAXBLOCKS+1) + blocks_in_bf2];
+	return KERNEL(compute_e_min)(blocks_in_bf1, blocks_in_bf2);
+}
+
+static PARAMETER_PROFILE KERNEL(profile);
+
+/*
+ * Best score of Bloom filter bf of fp against all Bloom filters of fingerprint,
+ * which are scanned in memory order. Pairs that cannot reach the threshold C
+ * are abandoned early, and the scan stops once the score reaches the
+ * saturation level (-S, 100 by default).
+ *
+ * With min_score > 0 only scores of at least min_score matter: a pair is
+ * abandoned as soon as it cannot reach min_score or the best score so far.
+ * The result is exact if it is at least min_score and below it otherwise.
+ */
+static int KERNEL(bloom_max_score)(FINGERPRINT *fp, unsigned int bf, FINGERPRINT *fingerprint, int min_score) {
+    int    C, cut, e_min, e_max;
+    unsigned int i;
+    int tmp_score = 0;
+    int score     = 0;
+    int saturation = mode->saturation;
+
+    const unsigned char *array = &fp->bf_array[(size_t)bf*FILTERSIZE];
+    int blocksOfBF1  = fp->bf_blocks[bf];
+    int bitsSetOfBF1 = fp->bf_bits_set[bf];
+    int tailBitsOfBF1 = fp->bf_tail_bits[bf];
+
+    const unsigned char *tmp_array = fingerprint->bf_array;
+
+    e_min = KERNEL(e_min)(blocksOfBF1, fingerprint->bf_blocks[0]);
+
+    for(i=0;i<=fingerprint->amount_of_BF;i++, tmp_array+=FILTERSIZE) {
+
+    	//Filters with 6 or less elements are critical
+    	if(fingerprint->bf_blocks[i] < MINBLOCKS){
+    				return score;
+    	}
+
+    	//for the last Bloom filter we have to update the values
+       	if(i == fingerprint->amount_of_BF) {
+           	e_min = KERNEL(e_min)(fingerprint->bf_blocks[i], blocksOfBF1);
+        }
+
+       	e_max = MIN(bitsSetOfBF1, fingerprint->bf_bits_set[i]);
+   	    C = 0.3*(e_max - e_min)+e_min;
+
+        //bits in common needed for a score of MAX(min_score, score+1), but
+        //at most the saturation level, where the scan stops at the first hit
+        cut = C;
+        if(min_score > 0 && (e_max - C) >= 1)
+        	cut = C + (MIN(MAX(min_score, score+1), saturation)*(e_max - C) + 99)/100;
+
+       	//compute bits in common
+        unsigned int numofbitsInCommon = KERNEL(profile).common_bits_cut(array, tmp_array, bitsSetOfBF1, tailBitsOfBF1, cut);
+
+        //if they are high enough we have a threshold
+        if((int)numofbitsInCommon < C) {
+            tmp_score = 0;
+        } else {
+        	if ((e_max - C) >= 1)
+        		tmp_score = 100*(numofbitsInCommon-C)/(e_max-C);
+        }
+
+        if(score < tmp_score){
+            score = tmp_score;
+            if(score >= saturation)
+            	break;
+        }
+    }
+    return score;
+}
+
+
+static PARAMETER_PROFILE KERNEL(profile) = {
+    PROFILE_NAME, PROFILE_DESCRIPTION,
+    ROLLING_HISTORY, BLOCK_SIZE, SKIPPED_BYTES, FILTERSIZE, MAXBLOCKS,
+    KERNEL(find_chunk_ends),
+    KERNEL(add_hash_to_bloomfilter),
+    KERNEL(count_bits_portable),
+    KERNEL(common_bits_portable),
+    KERNEL(filter_weights_portable),
+    KERNEL(common_bits_cut_portable),
+    KERNEL(compute_e_min),
+    KERNEL(bloom_max_score)
+};
+
+/*
+ * Fills the e_min table and picks the popcount kernels for cpu_level
+ */
+static void KERNEL(init)(int cpu_level)
+{
+    int b1, b2;
+
+    for(b1=0; b1<=MAXBLOCKS; b1++)
+        for(b2=0; b2<=MAXBLOCKS; b2++)
+            KERNEL(e_min_table)[b1*(MAXBLOCKS+1) + b2] = KERNEL(compute_e_min)(b1, b2);
+
+#if defined(X86_KERNELS)
+    if(cpu_level >= CPU_AVX512) {
+        KERNEL(profile).count_bits      = KERNEL(count_bits_avx512);
+        KERNEL(profile).common_bits     = KERNEL(common_bits_avx512);
+        KERNEL(profile).filter_weights  = KERNEL(filter_weights_avx512);
+        KERNEL(profile).common_bits_cut = KERNEL(common_bits_cut_avx512);
+    } else if(cpu_level >= CPU_AVX2) {
+        KERNEL(profile).count_bits      = KERNEL(count_bits_avx2);
+        KERNEL(profile).common_bits     = KERNEL(common_bits_avx2);
+        KERNEL(profile).filter_weights  = KERNEL(filter_weights_avx2);
+        KERNEL(profile).common_bits_cut = KERNEL(common_bits_cut_avx2);
+    } else if(cpu_level >= CPU_POPCNT) {
+        KERNEL(profile).count_bits      = KERNEL(count_bits_popcnt);
+        KERNEL(profile).common_bits     = KERNEL(common_bits_popcnt);
+        KERNEL(profile).filter_weights  = KERNEL(filter_weights_popcnt);
+        KERNEL(profile).common_bits_cut = KERNEL(common_bits_cut_popcnt);
+    }
+#endif
+}
@@ -0,0 +1,230 @@
+/*
+    File: profiles.c
+    Purpose: The parameter profiles of mrsh-v2, selected with -P
+
+    Each profile includes profile_kernels.c with its parameters defined as
+    macros. "default" uses the values of config.h; the others redefine the
+    parameters they change. Digests of different profiles cannot be compared.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../header/profile.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//the popcount kernels for x86 are compiled for their instruction set and picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+enum { CPU_PORTABLE, CPU_POPCNT, CPU_AVX2, CPU_AVX512 };
+
+//the popcount kernels count blocks of a multiple of this many bytes
+#define POPCOUNT_CHUNK  64
+
+
+static inline uint64 load_word(const unsigned char *p)
+{
+    uint64 w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline unsigned int popcount_word(uint64 v)
+{
+    v = v - ((v >> 1) & 0x5555555555555555ULL);                           //count of each 2 bits
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);  //count of each 4 bits
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;                            //count of each byte
+    return (v * 0x0101010101010101ULL) >> 56;
+}
+
+/*
+ * Bits set in the AND of the first bytes of a and b, once per instruction
+ * set. bytes has to be a multiple of POPCOUNT_CHUNK; passing the same filter
+ * twice counts its bits.
+ */
+static inline unsigned int popcount_block_portable(const unsigned char *a, const unsigned char *b, int bytes)
+{
+    unsigned int counted_bits = 0;
+    int k;
+
+    for(k=0; k<bytes; k+=8)
+        counted_bits += popcount_word(load_word(&a[k]) & load_word(&b[k]));
+    return counted_bits;
+}
+
+#if defined(X86_KERNELS)
+__attribute__((target("popcnt")))
+static inline unsigned int popcount_block_popcnt(const unsigned char *a, const unsigned char *b, int bytes)
+{
+    unsigned int counted_bits = 0;
+    int k;
+
+    for(k=0; k<bytes; k+=8)
+        counted_bits += __builtin_popcountll(load_word(&a[k]) & load_word(&b[k]));
+    return counted_bits;
+}
+
+/*
+ * Nibble lookup with vpshufb per byte, added up per 8 bytes with vpsadbw
+ */
+__attribute__((target("avx2")))
+static inline __m256i popcount_avx2(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+                                    _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int popcount_block_avx2(const unsigned char *a, const unsigned char *b, int bytes)
+{
+    __m256i sum = _mm256_setzero_si256();
+    __m128i half;
+    int k;
+
+    for(k=0; k<bytes; k+=32)
+        sum = _mm256_add_epi64(sum, popcount_avx2(_mm256_and_si256(
+                _mm256_loadu_si256((const __m256i *)&a[k]), _mm256_loadu_si256((const __m256i *)&b[k]))));
+    half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static inline unsigned int popcount_block_avx512(const unsigned char *a, const unsigned char *b, int bytes)
+{
+    __m512i sum = _mm512_setzero_si512();
+    int k;
+
+    for(k=0; k<bytes; k+=64)
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_loadu_si512(&a[k]), _mm512_loadu_si512(&b[k]))));
+    return _mm512_reduce_add_epi64(sum);
+}
+#endif
+
+
+#define KERNEL_NAME(name, id)   name##_##id
+#define KERNEL_ID(name, id)     KERNEL_NAME(name, id)
+#define KERNEL(name)            KERNEL_ID(name, PROFILE_ID)
+
+//the parameters of config.h
+#define PROFILE_ID              default
+#define PROFILE_NAME            "default"
+#define PROFILE_DESCRIPTION     "blocks of 160 bytes, 256-byte filters of 160 blocks (config.h)"
+#include "profile_kernels.c"
+#undef PROFILE_ID
+#undef PROFILE_NAME
+#undef PROFILE_DESCRIPTION
+
+#undef PROBABILITY
+#define PROBABILITY             (1.0 - 1.0/BLOOMFILTERBITSIZE)
+
+//the block size of the original mrsh-v2 release
+#undef BLOCK_SIZE
+#define BLOCK_SIZE              320
+#define PROFILE_ID              classic
+#define PROFILE_NAME            "classic"
+#define PROFILE_DESCRIPTION     "blocks of 320 bytes, 256-byte filters of 160 blocks"
+#include "profile_kernels.c"
+#undef PROFILE_ID
+#undef PROFILE_NAME
+#undef PROFILE_DESCRIPTION
+
+//small blocks for small objects and fragments
+#undef BLOCK_SIZE
+#define BLOCK_SIZE              64
+#define PROFILE_ID              fine
+#define PROFILE_NAME            "fine"
+#define PROFILE_DESCRIPTION     "blocks of 64 bytes, 256-byte filters of 160 blocks"
+#include "profile_kernels.c"
+#undef PROFILE_ID
+#undef PROFILE_NAME
+#undef PROFILE_DESCRIPTION
+
+//half the filter size with the same bits per block
+#undef BLOCK_SIZE
+#undef FILTERSIZE
+#undef SHIFTOPS
+#undef MASK
+#undef MAXBLOCKS
+#define BLOCK_SIZE              160
+#define FILTERSIZE              128
+#define SHIFTOPS                10
+#define MASK                    0x3FF
+#define MAXBLOCKS               80
+#define PROFILE_ID              compact
+#define PROFILE_NAME            "compact"
+#define PROFILE_DESCRIPTION     "blocks of 160 bytes, 128-byte filters of 80 blocks"
+#include "profile_kernels.c"
+#undef PROFILE_ID
+#undef PROFILE_NAME
+#undef PROFILE_DESCRIPTION
+
+
+static const struct {
+    PARAMETER_PROFILE *profile;
+    void (*init)(int cpu_level);
+} profiles[] = {
+    { &profile_default, init_default },
+    { &profile_classic, init_classic },
+    { &profile_fine,    init_fine },
+    { &profile_compact, init_compact }
+};
+
+const PARAMETER_PROFILE *profile = &profile_default;
+
+
+/*
+ * Fills the tables of the profile in use and picks the fastest popcount
+ * kernels the CPU supports; has to run before any digest is built or compared
+ */
+void init_profile()
+{
+    int cpu_level = CPU_PORTABLE;
+    size_t i;
+
+#if defined(X86_KERNELS)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("popcnt"))
+        cpu_level = CPU_POPCNT;
+    if(__builtin_cpu_supports("avx2"))
+        cpu_level = CPU_AVX2;
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+        cpu_level = CPU_AVX512;
+#endif
+
+    for(i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+        if(profiles[i].profile == profile)
+            profiles[i].init(cpu_level);
+}
+
+/*
+ * Returns the profile called name or NULL
+ */
+const PARAMETER_PROFILE *find_profile(const char *name)
+{
+    size_t i;
+
+    for(i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+        if(strcmp(profiles[i].profile->name, name) == 0)
+            return profiles[i].profile;
+
+    return NULL;
+}
+
+void print_profiles(FILE *out)
+{
+    size_t i;
+
+    for(i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+        fprintf(out, "\t%-10s%s\n", profiles[i].profile->name, profiles[i].profile->description);
+}
@@ -9,32 +9,42 @@ int readcommandline(char *argument,char *option)
    return 0;
 }
 
-unsigned int find_file_size(FILE *fh) 
+uint64 find_file_size(FILE *fh) 
 {
-  unsigned int size;
+  off_t size;
   if(fh != NULL)
    {
-    if( fseek(fh, 0, SEEK_END) )
+    if( fseeko(fh, 0, SEEK_END) )
     {
       return -1;
     }
-    size = ftell(fh);
+    size = ftello(fh);
     return size;
    }
    return -1; 
 }
 
-uint64 fnv64Bit( unsigned char pBuffer[], int start, int end)
+/*
+ * FNV-1 hash of pBuffer[start..end]; start == end+1 hashes an empty block
+ */
+uint64 fnv64Bit(const unsigned char pBuffer[], uint64 start, uint64 end)
+ {
+   return fnv64Bit_update(FNV64_INIT, &pBuffer[start], end+1-start);
+ }
+
+/*
+ * Continues a FNV-1 hash over the next piece of a block, so a block that is
+ * split over several read windows gives the same value as fnv64Bit()
+ */
+uint64 fnv64Bit_update(uint64 hashvalue, const unsigned char *pBuffer, size_t length)
  {
-   uint64 nHashVal    = 0xcbf29ce484222325ULL,
-          nMagicPrime = 0x00000100000001b3ULL;
+   const unsigned char *end = pBuffer + length;
 
-   int i = start;
-   while( i <= end ) {
-	   nHashVal ^= pBuffer[i++];
-	   nHashVal *= nMagicPrime;
+   while( pBuffer < end ) {
+	   hashvalue ^= *pBuffer++;
+	   hashvalue *= FNV64_PRIME;
    }
-   return nHashVal;
+   return hashvalue;
  }
 
 
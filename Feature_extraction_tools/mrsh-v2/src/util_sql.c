@@ -403,6 +403,53 @@ void inserting_new_feature_prepared_stmt(int id_obj, char* hash, int size_fet, c
   	sqlite3_reset(stmt);
 }
 
+/* writes value as uppercase hex without leading zeros (like "%X") and returns the length */
+static int format_hex32(uint32_t value, char *text){
+
+	static const char digits[] = "0123456789ABCDEF";
+	char reversed[8];
+	int n = 0, len = 0;
+
+	do {
+		reversed[n++] = digits[value & 0xF];
+		value >>= 4;
+	} while(value != 0);
+
+	while(n > 0)
+		text[len++] = reversed[--n];
+	text[len] = '\0';
+
+	return len;
+}
+
+void inserting_feature_record_prepared_stmt(int id_obj, uint64_t hash, uint32_t size_fet, uint64_t offset, sqlite3_stmt *stmt){
+
+	char hash_text[9], offset_text[9];
+	int hash_len = format_hex32((uint32_t)hash, hash_text);
+	int offset_len = format_hex32((uint32_t)offset, offset_text);
+
+	//Binding parameters...
+
+	if (sqlite3_bind_int(stmt, 1, id_obj) != SQLITE_OK ||
+	    sqlite3_bind_text(stmt, 2, hash_text, hash_len, SQLITE_STATIC) != SQLITE_OK ||
+	    sqlite3_bind_text(stmt, 3, offset_text, offset_len, SQLITE_STATIC) != SQLITE_OK ||
+	    sqlite3_bind_int(stmt, 4, size_fet) != SQLITE_OK) {
+		printf("\nCould not bind feature.\n");
+		sqlite3_reset(stmt);
+		return;
+	}
+
+	//Executing sql statement...
+
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+		printf("\nCould not step (execute) stmt.\n");
+
+	//Cleaning parameters values (the texts live on this stack frame)...
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
 void remove_existing_features(sqlite3 *db, int id_obj){
 
 	char sql[150];